@@ -44,6 +44,8 @@ ENDSEG   = SYSSEG + SYSSIZE		//! where to stop loading
 //! ROOT_DEV:	0x000 - same type of floppy as boot.
 //!		0x301 - first partition on first drive etc
 ROOT_DEV = 0x306 //! 根文件系统所在的设备
+//! SWAP_DEV:	0x000 - no swapping, else the swap partition (see mm/swap.c)
+SWAP_DEV = 0
 
 entry _start
 _start:
@@ -249,7 +251,9 @@ msg1:
 	.ascii "Loading system ..."
 	.byte 13,10,13,10
 
-.org 508
+.org 506
+swap_dev:
+	.word SWAP_DEV
 root_dev:
 	.word ROOT_DEV
 boot_flag:
@@ -12,7 +12,9 @@
  * the page directory.
  */
 .text
-.globl idt,gdt,pg_dir,tmp_floppy_area
+NR_TASKS = 512		/* must be the same as in <linux/tasks.h> */
+
+.globl idt,gdt,pg_dir,tmp_floppy_area,x86,x86_capability
 pg_dir:
 .globl startup_32
 startup_32:
@@ -35,6 +37,7 @@ startup_32:
 	movl %eax,0x000000	# loop forever if it isn't
 	cmpl %eax,0x100000
 	je 1b
+	call check_cpu
 
 /*
  * NOTE! 486 should set bit 16, to check for write-protect in supervisor
@@ -50,6 +53,46 @@ startup_32:
 	call check_x87
 	jmp after_page_tables
 
+/*
+ * Find out what cpu we are running on: a 386 can't toggle the AC flag,
+ * a 486 without cpuid can't toggle ID. Otherwise cpuid gives the family
+ * and the feature flags (we want PSE for setup_paging).
+ */
+check_cpu:
+	movl $3,x86
+	pushfl
+	popl %eax
+	movl %eax,%ecx		# save original EFLAGS
+	xorl $0x40000,%eax	# flip AC
+	pushl %eax
+	popfl
+	pushfl
+	popl %eax
+	xorl %ecx,%eax
+	andl $0x40000,%eax
+	je 1f			# 386
+	movl $4,x86
+	movl %ecx,%eax
+	xorl $0x200000,%eax	# flip ID
+	pushl %eax
+	popfl
+	pushfl
+	popl %eax
+	xorl %ecx,%eax
+	andl $0x200000,%eax
+	je 1f			# 486 without cpuid
+	pushl %ebx
+	movl $1,%eax
+	.byte 0x0f,0xa2		# cpuid
+	popl %ebx
+	andl $0xf00,%eax	# family
+	shrl $8,%eax
+	movl %eax,x86
+	movl %edx,x86_capability
+1:	pushl %ecx		# restore original EFLAGS
+	popfl
+	ret
+
 /*
  * We depend on ET to be correct. This checks for 287/387.
  */
@@ -110,8 +153,10 @@ setup_gdt:
 
 /*
  * I put the kernel page tables right after the page directory,
- * using 4 of them to span 16 Mb of physical memory. People with
- * more than 16MB will have to expand this.
+ * using 4 of them to span 16 Mb of physical memory. The rest, up
+ * to 64Mb, is mapped by mem_init(). With PSE only pg0 is used:
+ * 4-16Mb are 4Mb pages. The first 4Mb must stay a real page table,
+ * as the first fork() copies it (see copy_page_tables()).
  */
 .org 0x1000
 pg0:
@@ -203,12 +248,23 @@ setup_paging:
 	xorl %edi,%edi			/* pg_dir is at 0x000 */
 	cld;rep;stosl
 	movl $pg0+7,pg_dir		/* set present bit/user r/w */
-	movl $pg1+7,pg_dir+4		/*  --------- " " --------- */
+	testl $8,x86_capability		/* X86_FEATURE_PSE */
+	jz 2f
+	movl $0x400087,pg_dir+4		/* 4Mb page (PS), r/w user,p */
+	movl $0x800087,pg_dir+8		/*  --------- " " --------- */
+	movl $0xc00087,pg_dir+12	/*  --------- " " --------- */
+	movl %cr4,%eax
+	orl $0x10,%eax			/* set PSE */
+	movl %eax,%cr4
+	movl $pg0+4092,%edi
+	movl $0x3ff007,%eax		/*  4Mb - 4096 + 7 (r/w user,p) */
+	jmp 3f
+2:	movl $pg1+7,pg_dir+4		/*  --------- " " --------- */
 	movl $pg2+7,pg_dir+8		/*  --------- " " --------- */
 	movl $pg3+7,pg_dir+12		/*  --------- " " --------- */
 	movl $pg3+4092,%edi
 	movl $0xfff007,%eax		/*  16Mb - 4096 + 7 (r/w user,p) */
-	std
+3:	std
 1:	stosl			/* fill pages backwards - more efficient :-) */
 	subl $0x1000,%eax
 	jge 1b
@@ -227,14 +283,17 @@ idt_descr:
 .align 2
 .word 0
 gdt_descr:
-	.word 256*8-1		# so does gdt (not that that's any
-	.long gdt		# magic number, but it works for me :^)
+	.word (5+NR_TASKS)*8-1	# so does gdt: 4 fixed entries, the one
+	.long gdt		# shared TSS, and an LDT for each task
 
 	.align 8
 idt:	.fill 256,8,0		# idt is uninitialized
 
 gdt:	.quad 0x0000000000000000	/* NULL descriptor */
-	.quad 0x00c09a0000000fff	/* 16Mb */
-	.quad 0x00c0920000000fff	/* 16Mb */
+	.quad 0x00c09a0000003fff	/* 64Mb */
+	.quad 0x00c0920000003fff	/* 64Mb */
 	.quad 0x0000000000000000	/* TEMPORARY - don't use */
-	.fill 252,8,0			/* space for LDT's and TSS's etc */
+	.fill 1+NR_TASKS,8,0		/* space for the TSS and the LDT's */
+
+x86:	.long 3				/* set by check_cpu */
+x86_capability:	.long 0
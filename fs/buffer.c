@@ -19,6 +19,7 @@
  */
 
 #include <stdarg.h>
+#include <errno.h>
  
 #include <linux/config.h>
 #include <linux/sched.h>
@@ -31,8 +32,18 @@ extern void put_super(int);
 extern void invalidate_inodes(int);
 
 struct buffer_head * start_buffer = (struct buffer_head *) &end; // 内核模块空间之后
-struct buffer_head * hash_table[NR_HASH];
-static struct buffer_head * free_list;
+struct buffer_head ** hash_table;
+static int nr_hash = 0;		/* a power of two, set by buffer_init() */
+static int hash_shift;		/* 32 - log2(nr_hash) */
+static struct buffer_head * lru_list[NR_LIST] = {NULL, };
+static int nr_buffers_type[NR_LIST] = {0, };
+
+/* bdflush tuning, see sys_bdflush() */
+#define BDF_INTERVAL	(5*HZ)
+#define BDF_AGE		(30*HZ)
+#define BDF_RATIO	40
+#define BDF_NWRITE	64	/* max buffers written per round */
+
 static struct task_struct * buffer_wait = NULL;
 int NR_BUFFERS = 0;
 
@@ -64,7 +75,7 @@ int sys_sync(void)
 	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
 		wait_on_buffer(bh);
 		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+			ll_rw_block(WRITE,1,&bh);
 	}
 	return 0;
 }
@@ -82,7 +93,7 @@ int sync_dev(int dev)
 			continue;
 		wait_on_buffer(bh);
 		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+			ll_rw_block(WRITE,1,&bh);
 	}
 
 	// 第二次同步(就是inode的数据写到缓冲块的之后)
@@ -93,7 +104,7 @@ int sync_dev(int dev)
 			continue;
 		wait_on_buffer(bh);
 		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+			ll_rw_block(WRITE,1,&bh);
 	}
 	return 0;
 }
@@ -140,11 +151,78 @@ void check_disk_change(int dev)
 			put_super(super_block[i].s_dev);
 	invalidate_inodes(dev);
 	invalidate_buffers(dev);
+	invalidate_pages(dev,0);
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+/*
+ * The hash table has a power-of-two size, so we mask instead of taking
+ * a modulo. Sequential blocks of one device land in consecutive
+ * buckets, and the device number is scattered with a multiplicative
+ * (golden ratio) hash so that the same block on two devices doesn't
+ * collide. Blocks a multiple of nr_hash apart are folded in as well.
+ */
+#define _hashfn(dev,block) \
+	(((unsigned)(block) ^ ((unsigned)(block) >> (32-hash_shift)) ^ \
+	(((unsigned)(dev) * 0x9e370001UL) >> hash_shift)) & (nr_hash-1))
 #define hash(dev,block) hash_table[_hashfn(dev,block)]
 
+/*
+ * Buffers nobody is using (b_count == 0) are kept on one of NR_LIST
+ * circular lru-lists, chosen by what it costs to reuse them: clean
+ * ones first, then those that are still locked, then the dirty ones.
+ * This is the same order BADNESS() used to give, but getblk() now only
+ * has to look at the head of a list instead of walking all buffers.
+ * Buffers in use are on no list at all.
+ *
+ * An interrupt may unlock a buffer, and a sync may clean one, while it
+ * sits on a list. We don't want interrupts to touch the lists, so the
+ * list a buffer is on is only a hint: whoever finds it misfiled just
+ * moves it (see get_free_buffer()).
+ */
+#define BUF_TYPE(bh) ((bh)->b_dirt ? BUF_DIRTY : \
+	((bh)->b_lock ? BUF_LOCKED : BUF_CLEAN))
+
+static inline void remove_from_lru_list(struct buffer_head * bh)
+{
+	if (!bh->b_next_free)
+		return;
+	if (!bh->b_prev_free)
+		panic("Free block list corrupted");
+	if (bh->b_next_free == bh)
+		lru_list[bh->b_list] = NULL;
+	else {
+		bh->b_prev_free->b_next_free = bh->b_next_free;
+		bh->b_next_free->b_prev_free = bh->b_prev_free;
+		if (lru_list[bh->b_list] == bh)
+			lru_list[bh->b_list] = bh->b_next_free;
+	}
+	bh->b_next_free = bh->b_prev_free = NULL;
+	nr_buffers_type[bh->b_list]--;
+}
+
+/* put at end of the lru-list it belongs to (most recently used) */
+static inline void put_last_lru(struct buffer_head * bh)
+{
+	struct buffer_head ** list;
+
+	bh->b_list = BUF_TYPE(bh);
+	if (bh->b_list != BUF_DIRTY)
+		bh->b_flushtime = 0;
+	else if (!bh->b_flushtime)
+		bh->b_flushtime = jiffies + BDF_AGE;
+	list = lru_list + bh->b_list;
+	if (!*list) {
+		*list = bh;
+		bh->b_next_free = bh->b_prev_free = bh;
+	} else {
+		bh->b_next_free = *list;
+		bh->b_prev_free = (*list)->b_prev_free;
+		(*list)->b_prev_free->b_next_free = bh;
+		(*list)->b_prev_free = bh;
+	}
+	nr_buffers_type[bh->b_list]++;
+}
+
 static inline void remove_from_queues(struct buffer_head * bh)
 {
 /* remove from hash-queue */
@@ -154,22 +232,12 @@ static inline void remove_from_queues(struct buffer_head * bh)
 		bh->b_prev->b_next = bh->b_next;
 	if (hash(bh->b_dev,bh->b_blocknr) == bh)
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh)
-		free_list = bh->b_next_free;
+/* remove from lru-list */
+	remove_from_lru_list(bh);
 }
 
 static inline void insert_into_queues(struct buffer_head * bh)
 {
-/* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
 /* put the buffer in new hash-queue if it has a device */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
@@ -177,7 +245,33 @@ static inline void insert_into_queues(struct buffer_head * bh)
 		return;
 	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
 	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next)
+		bh->b_next->b_prev = bh;
+}
+
+/*
+ * get_free_buffer() returns the least recently used buffer of the
+ * cheapest non-empty lru-list, or NULL if every buffer is in use.
+ * Buffers found on the wrong list are refiled on the way; as each of
+ * them changed state since it was filed, this is O(1) amortized.
+ */
+static struct buffer_head * get_free_buffer(void)
+{
+	struct buffer_head * bh;
+	int i;
+
+	for (i=0 ; i<NR_LIST ; i++)
+		while ((bh = lru_list[i])) {
+			if (BUF_TYPE(bh) == i)
+				return bh;
+			remove_from_lru_list(bh);
+			put_last_lru(bh);
+			if (bh->b_list < i) {	/* got cheaper: start over */
+				i = -1;
+				break;
+			}
+		}
+	return NULL;
 }
 
 static struct buffer_head * find_buffer(int dev, int block)
@@ -190,6 +284,84 @@ static struct buffer_head * find_buffer(int dev, int block)
 	return NULL;
 }
 
+/*
+ * bdflush is the process that writes dirty buffers out in the
+ * background, so that getblk() nearly always finds a clean one to
+ * reuse. It wakes up every BDF_INTERVAL ticks and writes the dirty
+ * buffers that have been waiting for more than BDF_AGE ticks, oldest
+ * first. When more than BDF_RATIO percent of the buffers are dirty it
+ * is woken early, and doesn't look at the age.
+ *
+ * It is started by init, and never leaves the kernel.
+ */
+static struct task_struct * bdflush_wait = NULL;
+static struct task_struct * bdflush_task = NULL;
+static struct timer_list bdflush_timer = { NULL, NULL, 0, 0, NULL };
+
+#define too_many_dirty() \
+	(nr_buffers_type[BUF_DIRTY]*100 > BDF_RATIO*NR_BUFFERS)
+
+static inline void wakeup_bdflush(void)
+{
+	wake_up(&bdflush_wait);
+}
+
+static void bdflush_alarm(unsigned long unused)
+{
+	wakeup_bdflush();
+}
+
+static int flush_dirty_buffers(int all)
+{
+	struct buffer_head * bh;
+	int n = nr_buffers_type[BUF_DIRTY];
+	int written = 0;
+
+	while (written < BDF_NWRITE && n-- > 0 && (bh = lru_list[BUF_DIRTY])) {
+		if (BUF_TYPE(bh) == BUF_DIRTY) {
+			/*
+			 * The list is in lru order, not by b_flushtime: one
+			 * that isn't due yet goes to the end, those behind
+			 * it may be.
+			 */
+			if (!all && (long) bh->b_flushtime > jiffies) {
+				remove_from_lru_list(bh);
+				put_last_lru(bh);
+				continue;
+			}
+			ll_rw_block(WRITE,1,&bh);
+			written++;
+		}
+		/* it's locked or clean now, or somebody took it while we slept */
+		if (bh->b_next_free && BUF_TYPE(bh) != bh->b_list) {
+			remove_from_lru_list(bh);
+			put_last_lru(bh);
+		}
+	}
+	return written;
+}
+
+int sys_bdflush(void)
+{
+	if (!suser())
+		return -EPERM;
+	if (bdflush_task)
+		return -EBUSY;
+	bdflush_task = current;
+	for (;;) {
+		if (flush_dirty_buffers(too_many_dirty()) == BDF_NWRITE)
+			continue;
+		if (!timer_pending(&bdflush_timer)) {
+			bdflush_timer.expires = jiffies + BDF_INTERVAL;
+			bdflush_timer.function = bdflush_alarm;
+			add_timer(&bdflush_timer);
+		}
+		cli();
+		sleep_on(&bdflush_wait);
+		sti();
+	}
+}
+
 /*
  * Why like this, I hear you say... The reason is race-conditions.
  * As we don't lock buffers (unless we are readint them, that is),
@@ -204,11 +376,13 @@ struct buffer_head * get_hash_table(int dev, int block)
 	for (;;) {
 		if (!(bh=find_buffer(dev,block)))
 			return NULL;
-		bh->b_count++;
+		if (!bh->b_count++)
+			remove_from_lru_list(bh); // 被使用的缓冲块不在lru链表中
 		wait_on_buffer(bh); // 等待缓冲块被解锁(也就是缓冲块不在更新中)
 		if (bh->b_dev == dev && bh->b_blocknr == block)
 			return bh;
-		bh->b_count--;
+		if (!--bh->b_count)
+			put_last_lru(bh);
 	}
 }
 
@@ -219,28 +393,15 @@ struct buffer_head * get_hash_table(int dev, int block)
  *
  * The algoritm is changed: hopefully better, and an elusive bug removed.
  */
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
 struct buffer_head * getblk(int dev,int block)
 {
-	struct buffer_head * tmp, * bh;
+	struct buffer_head * bh;
 
 repeat:
 	if ((bh = get_hash_table(dev,block)))
 		return bh;
 
-	tmp = free_list; // 获取一个空闲的缓冲块
-	do {
-		if (tmp->b_count) // 如果有其他进程在使用此缓冲块, 跳过
-			continue;
-		if (!bh || BADNESS(tmp)<BADNESS(bh)) {
-			bh = tmp;
-			if (!BADNESS(tmp))
-				break;
-		}
-/* and repeat until we find something good */
-	} while ((tmp = tmp->b_next_free) != free_list);
-
-	if (!bh) { // 如果没有空闲的缓冲块, 等待
+	if (!(bh = get_free_buffer())) { // 如果没有空闲的缓冲块, 等待
 		sleep_on(&buffer_wait);
 		goto repeat;
 	}
@@ -254,8 +415,13 @@ repeat:
 	if (bh->b_count) // 在等待的过程中又被其他进程使用了, 重复上面操作
 		goto repeat;
 
+/*
+ * Only dirty buffers left: bdflush is behind. Kick it, and write out
+ * just this one ourselves rather than syncing the whole device.
+ */
 	while (bh->b_dirt) {
-		sync_dev(bh->b_dev); // 同步到硬盘 (这里才是触发写操作的地方)
+		wakeup_bdflush();
+		ll_rw_block(WRITE,1,&bh); // 同步到硬盘
 		wait_on_buffer(bh);  // 等待同步完成
 		if (bh->b_count)     // Oh! 又被其他进程占用了
 			goto repeat;
@@ -290,6 +456,11 @@ void brelse(struct buffer_head * buf)
 	wait_on_buffer(buf); // 等待缓冲块被解锁(等待其他进程释放)
 	if (!(buf->b_count--))
 		panic("Trying to free free buffer");
+	if (!buf->b_count) {
+		put_last_lru(buf);
+		if (buf->b_dirt && too_many_dirty())
+			wakeup_bdflush();
+	}
 	wake_up(&buffer_wait); // 唤醒正在等待空闲缓冲块的进程
 }
 
@@ -305,7 +476,7 @@ struct buffer_head * bread(int dev,int block)
 		panic("bread: getblk returned NULL\n");
 	if (bh->b_uptodate)   // 如果数据是最新的 (直接返回)
 		return bh;
-	ll_rw_block(READ,bh); // 发送IO命令
+	ll_rw_block(READ,1,&bh); // 发送IO命令
 	wait_on_buffer(bh);   // 等待IO完成
 	if (bh->b_uptodate)   // 如果IO命令执行成功
 		return bh;
@@ -320,31 +491,96 @@ __asm__("cld\n\t" \
 	::"c" (BLOCK_SIZE/4),"S" (from),"D" (to) \
 	)
 
+#define ZEROBLK(to) \
+__asm__("cld\n\t" \
+	"rep\n\t" \
+	"stosl\n\t" \
+	::"a" (0),"c" (BLOCK_SIZE/4),"D" (to) \
+	)
+
 /*
  * bread_page reads four buffers into memory at the desired address. It's
  * a function of its own, as there is some speed to be got by reading them
  * all at the same time, not waiting for one to be read, and then another
- * etc.
+ * etc. It returns 0 if all blocks could be read. Blocks that aren't
+ * there, or couldn't be read, are cleared: the page needn't be.
  */
-void bread_page(unsigned long address,int dev,int b[4])
+int bread_page(unsigned long address,int dev,int b[4])
 {
-	struct buffer_head * bh[4];
-	int i;
+	struct buffer_head * bh[4], * rd[4];
+	int i,nr = 0,err = 0;
 
 	for (i=0 ; i<4 ; i++)
 		if (b[i]) {
 			if ((bh[i] = getblk(dev,b[i])))
 				if (!bh[i]->b_uptodate)
-					ll_rw_block(READ,bh[i]);
+					rd[nr++] = bh[i];
 		} else
 			bh[i] = NULL;
+	ll_rw_block(READ,nr,rd);	// 一次提交, 相邻的块会合并成一个请求
 	for (i=0 ; i<4 ; i++,address += BLOCK_SIZE)
 		if (bh[i]) {
 			wait_on_buffer(bh[i]);
 			if (bh[i]->b_uptodate)
 				COPYBLK((unsigned long) bh[i]->b_data,address);
+			else {
+				ZEROBLK(address);
+				err = -1;
+			}
 			brelse(bh[i]);
+		} else {
+			ZEROBLK(address);
+			if (b[i])
+				err = -1;
 		}
+	return err;
+}
+
+/*
+ * bread_ahead() starts reading nr blocks, and returns without waiting
+ * for any of them. They are queued as one batch, so that adjacent
+ * blocks become one request. As with all read-ahead, blocks for which
+ * there is no free request are just forgotten.
+ */
+void bread_ahead(int dev,int b[],int nr)
+{
+	struct buffer_head * bh[NR_READA], * tmp;
+	int i,n = 0;
+
+	if (nr > NR_READA)
+		nr = NR_READA;
+	for (i=0 ; i<nr ; i++) {
+		if (!(tmp=getblk(dev,b[i])))
+			continue;
+		if (tmp->b_uptodate || tmp->b_lock) {
+			if (!--tmp->b_count)
+				put_last_lru(tmp);
+			continue;
+		}
+		bh[n++] = tmp;
+	}
+	ll_rw_block(READA,n,bh);
+	// 不等待IO完成, 直接释放 (缓冲块已经上锁, 读完之前getblk()不会重用它)
+	for (i=0 ; i<n ; i++)
+		if (!--bh[i]->b_count)
+			put_last_lru(bh[i]);
+}
+
+/*
+ * Are all the (non-zero) blocks of a page in the cache, uptodate and
+ * unlocked? Then bread_page() can put the page together without any
+ * I/O. Used by the executable fault-around in mm/memory.c.
+ */
+int page_uptodate(int dev,int b[4])
+{
+	struct buffer_head * bh;
+	int i;
+
+	for (i=0 ; i<4 ; i++)
+		if (b[i] && (!(bh = find_buffer(dev,b[i])) ||
+		    !bh->b_uptodate || bh->b_lock))
+			return 0;
+	return 1;
 }
 
 /*
@@ -355,22 +591,20 @@ void bread_page(unsigned long address,int dev,int b[4])
 struct buffer_head * breada(int dev,int first, ...)
 {
 	va_list args;
-	struct buffer_head * bh, *tmp;
+	struct buffer_head * bh;
+	int b[NR_READA];
+	int nr = 0;
 
 	va_start(args,first);
 	if (!(bh=getblk(dev,first)))
 		panic("bread: getblk returned NULL\n");
 	if (!bh->b_uptodate)
-		ll_rw_block(READ,bh);
-	while ((first=va_arg(args,int))>=0) {
-		tmp=getblk(dev,first);
-		if (tmp) {
-			if (!tmp->b_uptodate)
-				ll_rw_block(READA,bh);
-			tmp->b_count--;
-		}
-	}
+		ll_rw_block(READ,1,&bh);
+	while ((first=va_arg(args,int))>=0)
+		if (nr < NR_READA)
+			b[nr++] = first;
 	va_end(args);
+	bread_ahead(dev,b,nr);
 	wait_on_buffer(bh);
 	if (bh->b_uptodate)
 		return bh;
@@ -378,9 +612,40 @@ struct buffer_head * breada(int dev,int first, ...)
 	return (NULL);
 }
 
+/*
+ * show_buffer_hash() prints the distribution of the hash chain
+ * lengths, to see if the hash function does its job.
+ */
+#define NR_HIST 8
+
+void show_buffer_hash(void)
+{
+	int hist[NR_HIST+1];
+	struct buffer_head * bh;
+	int i,len,max = 0;
+
+	for (i=0 ; i<=NR_HIST ; i++)
+		hist[i] = 0;
+	for (i=0 ; i<nr_hash ; i++) {
+		for (len=0, bh=hash_table[i] ; bh ; bh=bh->b_next)
+			len++;
+		if (len > max)
+			max = len;
+		hist[(len < NR_HIST) ? len : NR_HIST]++;
+	}
+	printk("%d buffers, %d hash chains, longest %d\n\r",
+		NR_BUFFERS,nr_hash,max);
+	for (i=0 ; i<NR_HIST ; i++)
+		printk("%d:%d ",i,hist[i]);
+	printk("%d+:%d\n\r",NR_HIST,hist[NR_HIST]);
+	printk("lru: %d clean, %d locked, %d dirty\n\r",
+		nr_buffers_type[BUF_CLEAN],nr_buffers_type[BUF_LOCKED],
+		nr_buffers_type[BUF_DIRTY]);
+}
+
 void buffer_init(long buffer_end)
 {
-	struct buffer_head * h = start_buffer;
+	struct buffer_head * h;
 	void * b;
 	int i;
 
@@ -388,11 +653,26 @@ void buffer_init(long buffer_end)
 		b = (void *) (640*1024);
 	else
 		b = (void *) buffer_end;
+/*
+ * The hash table goes first, sized to about two buffers per chain.
+ * The number of buffers is only estimated here, but that's good enough.
+ */
+	i = ((long) b - (long) start_buffer) /
+		(BLOCK_SIZE + sizeof (struct buffer_head));
+	for (nr_hash = MIN_NR_HASH, hash_shift = 32-MIN_NR_HASH_BITS ;
+	     nr_hash < MAX_NR_HASH && 2*nr_hash < i ;
+	     nr_hash <<= 1, hash_shift--)
+		/* nothing */ ;
+	hash_table = (struct buffer_head **) start_buffer;
+	for (i=0;i<nr_hash;i++)
+		hash_table[i]=NULL;
+	h = start_buffer = (struct buffer_head *) (hash_table+nr_hash);
 	while ( (b -= BLOCK_SIZE) >= ((void *) (h+1)) ) {
 		h->b_dev = 0;
 		h->b_dirt = 0;
 		h->b_count = 0;
 		h->b_lock = 0;
+		h->b_list = BUF_CLEAN;
 		h->b_uptodate = 0;
 		h->b_wait = NULL;
 		h->b_next = NULL;
@@ -400,15 +680,16 @@ void buffer_init(long buffer_end)
 		h->b_data = (char *) b;
 		h->b_prev_free = h-1;
 		h->b_next_free = h+1;
+		h->b_flushtime = 0;
+		h->b_reqnext = NULL;
 		h++;
 		NR_BUFFERS++;
 		if (b == (void *) 0x100000)  // 跳过显存
 			b = (void *) 0xA0000;
 	}
 	h--;
-	free_list = start_buffer;
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
-	for (i=0;i<NR_HASH;i++)
-		hash_table[i]=NULL;
+	lru_list[BUF_CLEAN] = start_buffer;
+	lru_list[BUF_CLEAN]->b_prev_free = h;
+	h->b_next_free = lru_list[BUF_CLEAN];
+	nr_buffers_type[BUF_CLEAN] = NR_BUFFERS;
 }
@@ -198,7 +198,7 @@ static unsigned long change_ldt(unsigned long text_size,unsigned long * page)
 
 	code_limit = text_size+PAGE_SIZE -1;
 	code_limit &= 0xFFFFF000; // 内存页对齐
-	data_limit = 0x4000000;   // 数据段限制
+	data_limit = TASK_SIZE;   // 数据段限制
 	code_base = get_base(current->ldt[1]);
 	data_base = code_base;
 
@@ -214,7 +214,7 @@ static unsigned long change_ldt(unsigned long text_size,unsigned long * page)
 	for (i=MAX_ARG_PAGES-1 ; i>=0 ; i--) {
 		data_base -= PAGE_SIZE;
 		if (page[i])
-			put_page(page[i],data_base); // 映射线性地址与物理地址(data_base是线性地址)
+			put_dirty_page(page[i],data_base); // 映射线性地址与物理地址(data_base是线性地址)
 	}
 	return data_limit;
 }
@@ -378,8 +378,13 @@ restart_interp:
 			sys_close(i);
 	current->close_on_exec = 0;
 	// 释放进程占用的内存页(因为执行新程序的时候, 这些内存页都是没有用的)
-	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	// vfork的子进程只需要把内存还给父进程
+	if (!release_vfork(0)) {
+		free_page_tables(current->tss.cr3,
+			get_base(current->ldt[1]),get_limit(0x0f));
+		free_page_tables(current->tss.cr3,
+			get_base(current->ldt[2]),get_limit(0x17));
+	}
 	if (last_task_used_math == current)
 		last_task_used_math = NULL;
 	current->used_math = 0;
@@ -390,6 +395,8 @@ restart_interp:
 		(current->end_data = ex.a_data +
 		(current->end_code = ex.a_text));
 	current->start_stack = p & 0xfffff000;
+	current->anon_next = 0;
+	current->anon_cluster = 0;
 	current->euid = e_uid;
 	current->egid = e_gid;
 	i = ex.a_text+ex.a_data;
@@ -14,15 +14,48 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/*
+ * Read-ahead: a read that starts where the last one ended is taken
+ * as sequential. The file then gets a window of READA_MIN blocks,
+ * which doubles every time it is refilled, up to READA_MAX. A new
+ * batch is started when we get within half a window of its end, so
+ * the disk keeps going while the user copies. Any seek shuts it off.
+ */
+#define READA_MIN 4
+#define READA_MAX NR_READA
+
+static void file_readahead(struct m_inode * inode, struct file * filp, int block)
+{
+	int b[NR_READA];
+	int i,nr,end,n = 0;
+
+	i = MAX(block,filp->f_raend);
+	end = MIN(block+filp->f_reada,(inode->i_size+BLOCK_SIZE-1)/BLOCK_SIZE);
+	for ( ; i<end ; i++)
+		if ((nr = bmap(inode,i)))
+			b[n++] = nr;
+	bread_ahead(inode->i_dev,b,n);
+	filp->f_raend = MAX(end,block+1);
+	if (filp->f_reada < READA_MAX)
+		filp->f_reada <<= 1;
+}
+
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
-	int left,chars,nr;
+	int left,chars,nr,block;
 	struct buffer_head * bh;
 
 	if ((left=count)<=0)
 		return 0;
+	if (filp->f_pos != filp->f_rapos) // 不是顺序读, 关闭预读
+		filp->f_reada = filp->f_raend = 0;
+	else if (!filp->f_reada)
+		filp->f_reada = READA_MIN;
 	while (left) {
-		if ((nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE))) {
+		block = filp->f_pos/BLOCK_SIZE;
+		if (filp->f_reada && block+filp->f_reada/2 >= filp->f_raend)
+			file_readahead(inode,filp,block);
+		if ((nr = bmap(inode,block))) {
 			if (!(bh=bread(inode->i_dev,nr))) // blocking!!!
 				break;
 		} else
@@ -41,6 +74,7 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 				put_fs_byte(0,buf++);
 		}
 	}
+	filp->f_rapos = filp->f_pos;
 	inode->i_atime = CURRENT_TIME;
 	return (count-left)?(count-left):-ERROR;
 }
@@ -61,6 +95,7 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 		pos = inode->i_size;
 	else
 		pos = filp->f_pos;
+	invalidate_pages(inode->i_dev,inode->i_num); // 可执行文件的缓存页面已经过时
 	while (i<count) {
 		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
 			break;
@@ -196,6 +196,7 @@ int sys_umount(char * dev_name)
 	sb->s_isup = NULL;
 	put_super(dev);
 	sync_dev(dev);
+	invalidate_pages(dev,0);
 	return 0;
 }
 
@@ -14,6 +14,15 @@ __asm__ ("outb %%al,%%dx\n" \
 		"1:\tjmp 1f\n" \
 		"1:"::"a" (value),"d" (port))
 
+#define outl(value,port) \
+__asm__ ("outl %%eax,%%dx"::"a" (value),"d" (port))
+
+#define inl(port) ({ \
+unsigned long _v; \
+__asm__ volatile ("inl %%dx,%%eax":"=a" (_v):"d" (port)); \
+_v; \
+})
+
 #define inb_p(port) ({ \
 unsigned char _v; \
 __asm__ volatile ("inb %%dx,%%al\n" \
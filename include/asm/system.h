@@ -23,8 +23,20 @@ __asm__ ("movl %%esp,%%eax\n\t" \ // 把esp寄存器复制到eax
 #define cli() __asm__ ("cli"::)
 #define nop() __asm__ ("nop"::)
 
+#define save_flags(x) \
+__asm__ __volatile__("pushfl ; popl %0":"=r" (x))
+#define restore_flags(x) \
+__asm__ __volatile__("pushl %0 ; popfl"::"r" (x))
+
 #define iret() __asm__ ("iret"::)
 
+/* the TS flag in cr0: set, the next math instruction traps */
+#define clts() __asm__ __volatile__ ("clts"::)
+#define stts() \
+__asm__ __volatile__("movl %%cr0,%%eax\n\t" \
+	"orl $8,%%eax\n\t" \
+	"movl %%eax,%%cr0":::"ax")
+
 #define _set_gate(gate_addr,type,dpl,addr) \
 __asm__ ("movw %%dx,%%ax\n\t" \
 	"movw %0,%%dx\n\t" \
@@ -45,4 +45,12 @@
  leave HD_TYPE undefined. This is the normal thing to do.
 */
 
+/*
+ * Define HD_DMA to let the harddisk driver use PCI IDE bus-master dma
+ * (as on the PIIX, or qemu) instead of moving every word by hand. It
+ * falls back to the old way if no controller is found, the drive
+ * doesn't do dma, or a transfer fails.
+ */
+/* #define HD_DMA */
+
 #endif
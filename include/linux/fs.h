@@ -44,8 +44,15 @@ void buffer_init(long buffer_end);
 #define NR_INODE 32
 #define NR_FILE 64
 #define NR_SUPER 8
-#define NR_HASH 307
+#define MIN_NR_HASH_BITS 6	/* buffer hash is sized from nr_buffers */
+#define MIN_NR_HASH (1<<MIN_NR_HASH_BITS)
+#define MAX_NR_HASH 8192
 #define NR_BUFFERS nr_buffers
+#define BUF_CLEAN 0		/* lru-lists of unused buffers, see buffer.c */
+#define BUF_LOCKED 1
+#define BUF_DIRTY 2
+#define NR_LIST 3
+#define NR_READA 32		/* max blocks per bread_ahead() */
 #define BLOCK_SIZE 1024
 #define BLOCK_SIZE_BITS 10
 #ifndef NULL
@@ -73,11 +80,14 @@ struct buffer_head {
 	unsigned char b_dirt;		/* 0-clean,1-dirty */
 	unsigned char b_count;		/* users using this block */
 	unsigned char b_lock;		/* 0 - ok, 1 -locked (一般用户调用系统调用时被锁住, 硬盘中断时被解锁) */
+	unsigned char b_list;		/* lru-list the buffer was last filed on */
 	struct task_struct * b_wait;
 	struct buffer_head * b_prev;
 	struct buffer_head * b_next;
 	struct buffer_head * b_prev_free;
 	struct buffer_head * b_next_free;
+	unsigned long b_flushtime;	/* when bdflush should write it out */
+	struct buffer_head * b_reqnext;	/* next buffer in the same request */
 };
 
 struct d_inode {
@@ -119,6 +129,9 @@ struct file {
 	unsigned short f_count;
 	struct m_inode * f_inode;
 	off_t f_pos;
+	off_t f_rapos;			/* f_pos after the last read */
+	unsigned long f_reada;	/* read-ahead window, in blocks */
+	unsigned long f_raend;	/* first block not yet read ahead */
 };
 
 struct super_block {
@@ -185,11 +198,14 @@ extern struct m_inode * get_empty_inode(void);
 extern struct m_inode * get_pipe_inode(void);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
-extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern void ll_rw_block(int rw, int nr, struct buffer_head * bh[]);
+extern int ll_rw_page(int rw, int dev, int nr, char * buffer);
 extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
-extern void bread_page(unsigned long addr,int dev,int b[4]);
+extern int bread_page(unsigned long addr,int dev,int b[4]);
 extern struct buffer_head * breada(int dev,int block,...);
+extern void bread_ahead(int dev,int b[],int nr);
+extern int page_uptodate(int dev,int b[4]);
 extern int new_block(int dev);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
@@ -40,6 +40,12 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4	/* read sectors, one intr per block */
+#define WIN_MULTWRITE		0xC5
+#define WIN_SETMULT		0xC6	/* set sectors per block */
+#define WIN_READDMA		0xC8	/* bus-master dma, see HD_DMA */
+#define WIN_WRITEDMA		0xCA
+#define WIN_IDENTIFY		0xEC	/* ask drive for its parameters */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
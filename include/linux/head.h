@@ -6,7 +6,13 @@ typedef struct desc_struct {
 } desc_table[256];
 
 extern unsigned long pg_dir[1024];
-extern desc_table idt,gdt;
+extern desc_table idt;
+extern struct desc_struct gdt[];	/* 5+NR_TASKS entries, see head.s */
+
+/* set up by head.s: cpu family (3, 4, ...) and cpuid feature flags */
+extern unsigned long x86, x86_capability;
+
+#define X86_FEATURE_PSE 0x00000008	/* 4Mb pages */
 
 #define GDT_NUL 0
 #define GDT_CODE 1
@@ -3,8 +3,69 @@
 
 #define PAGE_SIZE 4096
 
+/* these are not to be changed without changing head.s etc */
+#define LOW_MEM 0x100000
+#define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
+
+/*
+ * Every task (but task 0, which uses pg_dir) has a page directory of its
+ * own, at tss.cr3. The entries for the first 64Mb are the kernel's and
+ * the same in all of them, user space is always at TASK_BASE. So the
+ * number of tasks doesn't depend on how many 64Mb slots there are in
+ * the 4Gb linear space.
+ */
+#define TASK_BASE 0x4000000
+#define TASK_SIZE 0x4000000
+
+/* the page directory entry of linear address 'addr' in directory 'dir' */
+#define PDE(dir,addr) ((unsigned long *) ((dir) + (((addr)>>20) & 0xffc)))
+
+/*
+ * invalidate() flushes the whole tlb. When only one pte has changed,
+ * use invalidate_page() (mm/memory.c) instead: on a 486 or better that
+ * is a single invlpg, which leaves the other entries alone.
+ */
+extern unsigned long tlb_flushes, tlb_page_flushes;
+
+#define invalidate() \
+do { \
+	tlb_flushes++; \
+	__asm__("movl %%cr3,%%eax\n\tmovl %%eax,%%cr3":::"ax"); \
+} while (0)
+
+extern void invalidate_page(unsigned long address);
+
+/* switch to another page directory (which flushes the tlb as well) */
+#define load_cr3(dir) \
+__asm__ __volatile__("movl %%eax,%%cr3"::"a" (dir))
+
+/* page table entry bits */
+#define PAGE_DIRTY	0x40
+#define PAGE_ACCESSED	0x20
+#define PAGE_RW		0x02
+#define PAGE_PRESENT	0x01
+
+extern long HIGH_MEMORY;
+extern unsigned char * mem_map;
+
+/* both may sleep (swapping out) when memory is short: see mm/memory.c */
 extern unsigned long get_free_page(void);
+extern unsigned long __get_free_page(void);
 extern unsigned long put_page(unsigned long page,unsigned long address);
+extern unsigned long put_dirty_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
+extern volatile void oom(void);
+extern void invalidate_pages(int dev, int ino);
+extern int nr_free_pages;
+extern void fill_zero_pool(void);
+
+/* mm/swap.c */
+extern int SWAP_DEV;
+#define read_swap_page(nr,buffer) ll_rw_page(READ,SWAP_DEV,(nr),(buffer))
+#define write_swap_page(nr,buffer) ll_rw_page(WRITE,SWAP_DEV,(nr),(buffer))
+extern void init_swapping(void);
+extern void swap_free(int swap_nr);
+extern void swap_in(unsigned long * table_ptr);
+extern int swap_out(void);
 
 #endif
@@ -1,7 +1,8 @@
 #ifndef _SCHED_H
 #define _SCHED_H
 
-#define NR_TASKS 64
+#include <linux/tasks.h>
+
 #define HZ 100
 
 #define FIRST_TASK task[0]
@@ -10,12 +11,17 @@
 #include <linux/head.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/timer.h>
 #include <signal.h>
 
 #if (NR_OPEN > 32)
 #error "Currently the close-on-exec-flags are in one word, max 32 files/proc"
 #endif
 
+#if (NR_TASKS & 31) || (NR_TASKS > 8187)
+#error "NR_TASKS must be a multiple of 32, and at most 8187"
+#endif
+
 #define TASK_RUNNING		0
 #define TASK_INTERRUPTIBLE	1
 #define TASK_UNINTERRUPTIBLE	2
@@ -26,8 +32,11 @@
 #define NULL ((void *) 0)
 #endif
 
-extern int copy_page_tables(unsigned long from, unsigned long to, long size);
-extern int free_page_tables(unsigned long from, unsigned long size);
+extern int copy_page_tables(unsigned long from_dir, unsigned long to_dir,
+	unsigned long from, unsigned long to, long size);
+extern int free_page_tables(unsigned long dir, unsigned long from,
+	unsigned long size);
+extern unsigned long new_page_dir(void);
 
 extern void sched_init(void);
 extern void schedule(void);
@@ -112,8 +121,26 @@ struct task_struct {
 	struct file * filp[NR_OPEN];  // 打开的文件描述符
 /* ldt for this task 0 - zero 1 - cs 2 - ds&ss */
 	struct desc_struct ldt[3];
-/* tss for this task */
+/* tss for this task: only used to keep esp0, cr3 and the math state,
+   and the kernel esp and eip switch_to() left it at - see there */
 	struct tss_struct tss;
+/* vfork: set while the child runs in its parent's memory */
+	int vfork;
+	struct task_struct * vfork_wait;
+/* heap and stack fault-around, see do_anon_page() in mm/memory.c */
+	unsigned long anon_next;
+	int anon_cluster;
+/* run queue links, see schedule() */
+	struct task_struct * run_next, * run_prev;
+	int run_level;		/* -1 if not on a run queue */
+	unsigned long epoch;
+	int nr;			/* index in task[] */
+	struct task_struct * pid_next;	/* pid hash chain, see fork.c */
+/* time slices in a row that used the math unit, see schedule() */
+	unsigned char fpu_counter;
+	unsigned char fpu_used;		/* ... in this one */
+/* sends SIGALRM when alarm is reached, see set_alarm() */
+	struct timer_list alarm_timer;
 };
 
 /*
@@ -144,6 +171,7 @@ struct task_struct {
 }
 
 extern struct task_struct *task[NR_TASKS];
+extern struct tss_struct cpu_tss;
 extern struct task_struct *last_task_used_math;
 extern struct task_struct *current;
 extern long volatile jiffies;
@@ -151,48 +179,76 @@ extern long startup_time;
 
 #define CURRENT_TIME (startup_time+jiffies/HZ)
 
-extern void add_timer(long jiffies, void (*fn)(void));
 extern void sleep_on(struct task_struct ** p);
 extern void interruptible_sleep_on(struct task_struct ** p);
 extern void wake_up(struct task_struct ** p);
+extern void wake_up_process(struct task_struct * p);
+extern void signal_wake_up(struct task_struct * p);
+extern void set_alarm(long when);
+extern int release_vfork(int exiting);
+extern struct task_struct * find_task_by_pid(long pid);
 
 /*
- * Entry into gdt where to find first TSS. 0-nul, 1-cs, 2-ds, 3-syscall
- * 4-TSS0, 5-LDT0, 6-TSS1 etc ...
+ * Entry into gdt where to find the TSS and the first LDT. 0-nul, 1-cs,
+ * 2-ds, 3-syscall 4-TSS, 5-LDT0, 6-LDT1 etc ... There is only one TSS
+ * (see switch_to()), head.s makes the gdt big enough for NR_TASKS LDTs.
  */
-#define FIRST_TSS_ENTRY 4
-#define FIRST_LDT_ENTRY (FIRST_TSS_ENTRY+1)
-#define _TSS(n) ((((unsigned long) n)<<4)+(FIRST_TSS_ENTRY<<3))
-#define _LDT(n) ((((unsigned long) n)<<4)+(FIRST_LDT_ENTRY<<3))
-// 加载任务n的TSS
-#define ltr(n) __asm__("ltr %%ax"::"a" (_TSS(n)))
+#define TSS_ENTRY 4
+#define FIRST_LDT_ENTRY (TSS_ENTRY+1)
+#define _LDT(n) ((((unsigned long) n)<<3)+(FIRST_LDT_ENTRY<<3))
+// 加载TSS
+#define ltr() __asm__("ltr %%ax"::"a" (TSS_ENTRY<<3))
 // 加载任务n的LDT
 #define lldt(n) __asm__("lldt %%ax"::"a" (_LDT(n)))
-#define str(n) \
-__asm__("str %%ax\n\t" \
-	"subl %2,%%eax\n\t" \
-	"shrl $4,%%eax" \
-	:"=a" (n) \
-	:"a" (0),"i" (FIRST_TSS_ENTRY<<3))
 /*
  *	switch_to(n) should switch tasks to task nr n, first
  * checking that n isn't the current task, in which case it does nothing.
- * This also clears the TS-flag if the task we switched to has used
- * tha math co-processor latest.
+ *
+ * This doesn't use the hardware task switch any more: an ljmp through a
+ * TSS is very slow, it saves and loads every register, and cr3 even if
+ * it doesn't change. The one TSS (cpu_tss) only gives the kernel stack
+ * for traps from user mode, so esp0 is set here. The ldt is loaded, and
+ * cr3 only if the new task has another page directory (a vfork()ed child
+ * has its parent's). Then the kernel stacks are swapped: the registers
+ * gcc expects to be kept, and fs and gs (reloaded from the new ldt), are
+ * pushed on the old one, and the old task's tss gets esp and the address
+ * to continue at. A new task continues at ret_from_fork, see fork.c.
+ *
+ * The TS-flag is set by hand now, unless the task we switched to has
+ * used tha math co-processor latest.
  */
-#define switch_to(n) {                   \
-struct {long a,b;} __tmp;                \
-__asm__("cmpl %%ecx,current\n\t"         \
-	"je 1f\n\t"                          \
-	"movw %%dx,%1\n\t"                   \
-	"xchgl %%ecx,current\n\t"            \
-	"ljmp *%0\n\t"                       \
-	"cmpl %%ecx,last_task_used_math\n\t" \
-	"jne 1f\n\t"                         \
-	"clts\n"                             \
-	"1:"                                 \
-	::"m" (*&__tmp.a),"m" (*&__tmp.b),   \
-	"d" (_TSS(n)),"c" ((long) task[n])); \
+#define switch_to(n) { \
+struct task_struct * __prev = current, * __next = task[n]; \
+if (__next != __prev) { \
+	cpu_tss.esp0 = __next->tss.esp0; \
+	lldt(n); \
+	if (__next->tss.cr3 != __prev->tss.cr3) \
+		load_cr3(__next->tss.cr3); \
+	if (__next == last_task_used_math) \
+		clts(); \
+	else \
+		stts(); \
+	current = __next; \
+	__asm__ __volatile__("pushl %%ebx\n\t" \
+		"pushl %%esi\n\t" \
+		"pushl %%edi\n\t" \
+		"pushl %%ebp\n\t" \
+		"push %%fs\n\t" \
+		"push %%gs\n\t" \
+		"movl %%esp,%0\n\t" \
+		"movl %2,%%esp\n\t" \
+		"movl $1f,%1\n\t" \
+		"jmp *%3\n" \
+		"1:\tpop %%gs\n\t" \
+		"pop %%fs\n\t" \
+		"popl %%ebp\n\t" \
+		"popl %%edi\n\t" \
+		"popl %%esi\n\t" \
+		"popl %%ebx" \
+		:"=m" (__prev->tss.esp),"=m" (__prev->tss.eip) \
+		:"m" (__next->tss.esp),"m" (__next->tss.eip) \
+		:"ax","cx","dx","memory"); \
+} \
 }
 
 #define PAGE_ALIGN(n) (((n)+0xfff)&0xfffff000)
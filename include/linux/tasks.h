@@ -0,0 +1,12 @@
+#ifndef _TASKS_H
+#define _TASKS_H
+
+/*
+ * This is the maximum nr of tasks - change it if you need to, but
+ * change NR_TASKS in boot/head.s as well: the gdt has an LDT entry for
+ * each task, so it can't hold more than 8187. It must be a multiple of
+ * 32 too (the free slot bitmap in fork.c).
+ */
+#define NR_TASKS 512
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+/*
+ * Kernel timers. Fill in expires (an absolute time in jiffies), function
+ * and data, and add_timer() it: function(data) is then called from the
+ * timer interrupt once jiffies has reached expires. del_timer() takes a
+ * timer off again before that, it returns 1 if the timer was pending.
+ * mod_timer() is both, for a timer that may or may not be pending.
+ *
+ * A timer is pending when pprev is set: init_timer() it (or zero it)
+ * before it is used the first time. Timers are kept in a wheel, see
+ * kernel/sched.c, so adding and deleting them doesn't depend on how
+ * many there are, and there is no limit on that.
+ */
+struct timer_list {
+	struct timer_list * next, ** pprev;
+	unsigned long expires;
+	unsigned long data;
+	void (*function)(unsigned long);
+};
+
+#define init_timer(t) ((t)->next = NULL, (t)->pprev = NULL)
+#define timer_pending(t) ((t)->pprev != NULL)
+
+extern void add_timer(struct timer_list * timer);
+extern int del_timer(struct timer_list * timer);
+extern void mod_timer(struct timer_list * timer, unsigned long expires);
+
+#endif
@@ -129,6 +129,8 @@
 #define __NR_ssetmask	69
 #define __NR_setreuid	70
 #define __NR_setregid	71
+#define __NR_bdflush	72
+#define __NR_vfork	73
 
 #define _syscall0(type,name) \
 type name(void) \
@@ -208,6 +210,7 @@ volatile void exit(int status);
 volatile void _exit(int status);
 int fcntl(int fildes, int cmd, ...);
 int fork(void);
+int vfork(void);
 int getpid(void);
 int getuid(void);
 int geteuid(void);
@@ -24,6 +24,7 @@ static inline _syscall0(int,fork)
 static inline _syscall0(int,pause)
 static inline _syscall1(int,setup,void *,BIOS)
 static inline _syscall0(int,sync)
+static inline _syscall0(int,bdflush)
 
 #include <linux/tty.h>
 #include <linux/sched.h>
@@ -58,6 +59,7 @@ extern long startup_time;
 #define EXT_MEM_K (*(unsigned short *)0x90002)
 #define DRIVE_INFO (*(struct drive_info *)0x90080)
 #define ORIG_ROOT_DEV (*(unsigned short *)0x901FC)
+#define ORIG_SWAP_DEV (*(unsigned short *)0x901FA)
 
 /*
  * Yeah, yeah, it's ugly, but I cannot find how to do this correctly
@@ -111,12 +113,19 @@ void main(void)		/* This really IS void, no error here. */
  * enable them
  */
  	ROOT_DEV = ORIG_ROOT_DEV;
+ 	SWAP_DEV = ORIG_SWAP_DEV;
  	drive_info = DRIVE_INFO;
 	memory_end = (1<<20) + (EXT_MEM_K<<10);
 	memory_end &= 0xfffff000; /* 3GB */
-	if (memory_end > 16*1024*1024) // 如果大于16M, 只支持16M的内存
-		memory_end = 16*1024*1024;
-	if (memory_end > 12*1024*1024)
+	if (memory_end > 64*1024*1024) // 内核只映射了64M (任务0的线性空间)
+		memory_end = 64*1024*1024;
+	// 1/4给缓冲区, 但最多12M: mem_init()的页表和mem_map要放在16M以下
+	if (memory_end > 16*1024*1024) {
+		buffer_memory_end = (memory_end/4) & 0xfffff000;
+		if (buffer_memory_end > 12*1024*1024)
+			buffer_memory_end = 12*1024*1024;
+	}
+	else if (memory_end > 12*1024*1024)
 		buffer_memory_end = 4*1024*1024;  // 4M
 	else if (memory_end > 6*1024*1024)
 		buffer_memory_end = 2*1024*1024;  // 2M
@@ -177,6 +186,10 @@ void init(void)
 	int pid,i;
 
 	setup((void *) &drive_info); // 挂载根文件系统 (sys_setup)
+	if (!fork()) {		/* the dirty-buffer flusher: never returns */
+		bdflush();
+		_exit(1);
+	}
 	(void) open("/dev/tty0",O_RDWR,0);
 	(void) dup(0);
 	(void) dup(0);
@@ -11,14 +11,31 @@
  * from the elevator-mechanism, but not so much as to lock a lot of
  * buffers when they are in the queue. 64 seems to be too many (easily
  * long pauses in reading when heavy writing/syncing is going on)
+ *
+ * The requests are split up between the devices, so that a slow
+ * one (the floppy) can't take them all. BLK_REQUESTS gives the share
+ * of each major, and has to add up to NR_REQUEST. The 2/3 rule above
+ * is per device.
  */
-#define NR_REQUEST	32
+#define NR_REQUEST	48
+#define BLK_REQUESTS	{ 0, 8, 8, 32, 0, 0, 0 }	/* -, ram, fd, hd */
+
+/*
+ * Adjacent buffers are merged into one request, up to this many
+ * sectors. The hd sector-count register is 8 bits.
+ */
+#define MAX_SECTORS	128
 
 /*
  * Ok, this is an expanded form so that we can use the same
  * request for paging requests when that is implemented. In
  * paging, 'bh' is NULL, and 'waiting' is used to wait for
  * read/write completion.
+ *
+ * A request may cover several buffers, chained through b_reqnext.
+ * 'sector', 'nr_sectors' and 'buffer' always describe what is left
+ * to do, and 'current_nr_sectors' is what is left of the first
+ * buffer in the chain.
  */
 struct request {
 	int dev;		/* -1 if no request */
@@ -26,34 +43,58 @@ struct request {
 	int errors;
 	unsigned long sector;
 	unsigned long nr_sectors;
+	unsigned long current_nr_sectors;
 	char * buffer;
 	struct task_struct * waiting; // 等待请求的进程
 	struct buffer_head * bh;
+	struct buffer_head * bhtail;  // 链表最后一个缓冲块, 用于向后合并
+	unsigned long deadline;       // 超时时间(jiffies), 只有deadline调度器使用
+	int * uptodate;		/* ll_rw_page() has no buffer to tell, see end_request() */
 	struct request * next;
 };
 
 /*
- * This is used in the elevator algorithm: Note that
- * reads always go before writes. This is natural: reads
- * are much more time-critical than writes.
+ * This is used in the elevator algorithm: the queue is kept sorted
+ * by device and sector, one sweep upwards from the current request,
+ * then one from the bottom (C-LOOK).
  */
 // 电梯算法
-// 1) 读命令比写命令优先
-// 2) 小设备号比大设备号优先
-// 3) 小扇区号比大扇区号优先
+// 1) 小设备号比大设备号优先
+// 2) 小扇区号比大扇区号优先
 #define IN_ORDER(s1,s2) \
-((s1)->cmd<(s2)->cmd || ((s1)->cmd==(s2)->cmd && \
 ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
-(s1)->sector < (s2)->sector))))
+(s1)->sector < (s2)->sector))
+
+struct blk_dev_struct;
+
+/*
+ * The i/o scheduler of a device, set by its driver at init time.
+ * add() puts a new request in the queue behind the current one, and
+ * next() drops the current request and returns the one to do next.
+ * Both are called with interrupts off, next() from end_request().
+ */
+struct elevator {
+	char * name;
+	void (*add)(struct blk_dev_struct * dev, struct request * req);
+	struct request * (*next)(struct blk_dev_struct * dev);
+};
 
 struct blk_dev_struct {
 	void (*request_fn)(void);
 	struct request * current_request;
+	struct elevator * elevator;
+	unsigned long nr_dispatch;	/* requests started */
+	unsigned long nr_merge;		/* buffers merged into a queued request */
+	unsigned long nr_expired;	/* requests moved up by their deadline */
+	struct request * requests;	/* this device's part of request[] */
+	int nr_requests;
+	struct task_struct * wait_for_request;
 };
 
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];
 extern struct request request[NR_REQUEST];
-extern struct task_struct * wait_for_request;
+extern struct elevator clook_elevator, deadline_elevator;
+extern struct request * next_request(struct blk_dev_struct * dev);
 
 #ifdef MAJOR_NR
 
@@ -110,25 +151,45 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait);
 }
 
+/*
+ * end_request() finishes the first buffer of the current request.
+ * If more buffers are chained behind it, the request is advanced
+ * past whatever is left of this one and stays current: the driver
+ * just carries on. Only the last buffer frees the request.
+ */
 // 减少硬盘读写请求的只有这个函数
 // 而这个函数只有硬盘中断发生时才会被调用
 static inline void end_request(int uptodate)
 {
-	DEVICE_OFF(CURRENT->dev);
-	if (CURRENT->bh) {                      // 因为有些请求不需要缓冲区的(例如重置命令)
-		CURRENT->bh->b_uptodate = uptodate; // 设置缓冲块的标志为更新状态
-		unlock_buffer(CURRENT->bh);         // 解锁缓冲块
-	}
+	struct buffer_head * bh;
+
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
-		printk("dev %04x, block %d\n\r",CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+		printk("dev %04x, sector %d\n\r",CURRENT->dev,
+			CURRENT->sector);
 	}
+	if ((bh = CURRENT->bh)) {               // 因为有些请求不需要缓冲区的(例如重置命令)
+		CURRENT->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = uptodate;          // 设置缓冲块的标志为更新状态
+		unlock_buffer(bh);                  // 解锁缓冲块
+		if (CURRENT->bh) {                  // 请求中还有其他缓冲块, 继续处理
+			CURRENT->sector += CURRENT->current_nr_sectors;
+			CURRENT->nr_sectors -= CURRENT->current_nr_sectors;
+			CURRENT->current_nr_sectors = 2;
+			CURRENT->buffer = CURRENT->bh->b_data;
+			CURRENT->errors = 0;
+			return;
+		}
+	}
+	DEVICE_OFF(CURRENT->dev);
+	if (CURRENT->uptodate)
+		*CURRENT->uptodate = uptodate;
 	wake_up(&CURRENT->waiting); // 唤醒等待请求的进程
-	wake_up(&wait_for_request); // 唤醒等待request结构的进程
-	// 释放当前请求结构, 并且指向一下个请求
+	wake_up(&blk_dev[MAJOR_NR].wait_for_request); // 唤醒等待request结构的进程
+	// 释放当前请求结构, 由调度器选出下一个请求
 	CURRENT->dev = -1;
-	CURRENT = CURRENT->next;
+	CURRENT = next_request(blk_dev+MAJOR_NR);
 }
 
 #define INIT_REQUEST                                   \
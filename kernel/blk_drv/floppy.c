@@ -401,7 +401,28 @@ static void reset_floppy(void)
 	sti();
 }
 
-static void floppy_on_interrupt(void)
+/*
+ * fd_timer waits for the motor to come up, and for a newly selected
+ * drive to settle, before the transfer.
+ */
+static struct timer_list fd_timer = { NULL, NULL, 0, 0, NULL };
+
+static void fd_delay(long ticks, void (*fn)(unsigned long))
+{
+	if (ticks <= 0) {
+		fn(0);
+		return;
+	}
+	fd_timer.function = fn;
+	mod_timer(&fd_timer,jiffies+ticks);
+}
+
+static void transfer_timeout(unsigned long unused)
+{
+	transfer();
+}
+
+static void floppy_on_interrupt(unsigned long unused)
 {
 /* We cannot do a floppy-select, as that might sleep. We just force it */
 	selected = 1;
@@ -409,7 +430,7 @@ static void floppy_on_interrupt(void)
 		current_DOR &= 0xFC;
 		current_DOR |= current_drive;
 		outb(current_DOR,FD_DOR);
-		add_timer(2,&transfer);
+		fd_delay(2,transfer_timeout);
 	} else
 		transfer();
 }
@@ -451,7 +472,7 @@ void do_fd_request(void)
 		command = FD_WRITE;
 	else
 		panic("do_fd_request: unknown command");
-	add_timer(ticks_to_floppy_on(current_drive),&floppy_on_interrupt);
+	fd_delay(ticks_to_floppy_on(current_drive),floppy_on_interrupt);
 }
 
 void floppy_init(void)
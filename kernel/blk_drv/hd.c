@@ -23,6 +23,7 @@
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/hdreg.h>
+#include <linux/mm.h>
 #include <asm/system.h>
 #include <asm/io.h>
 #include <asm/segment.h>
@@ -39,11 +40,29 @@ inb_p(0x71);               \
 #define MAX_ERRORS	7
 #define MAX_HD		2
 
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
 static void recal_intr(void);
+static void hd_identify(int drive);
 
 static int recalibrate = 1;
 static int reset = 1;
 
+/*
+ * Drives that know READ/WRITE MULTIPLE move hd_mult[] sectors per
+ * interrupt instead of one. The block size has to be set again after
+ * every controller reset: need_setmult has a bit per drive for that.
+ * hd_xfer is the block size of the command in progress.
+ */
+static int hd_mult[MAX_HD] = {0,};
+static int need_setmult = 0;
+static int hd_xfer = 1;
+
+#ifdef HD_DMA
+static void hd_dma_init(void);
+static int hd_dma[MAX_HD] = {0,};	/* drive said it can do dma */
+#endif
+
 /*
  *  This struct defines the HD's and their types.
  */
@@ -147,6 +166,15 @@ int sys_setup(void * BIOS)
 		hd[i*5].start_sect = 0;
 		hd[i*5].nr_sects = 0;
 	}
+	for (drive=0 ; drive<NR_HD ; drive++) {
+		hd_identify(drive);
+		if (hd_mult[drive])
+			printk("hd%d: %d sectors per interrupt\n\r",
+				drive,hd_mult[drive]);
+	}
+#ifdef HD_DMA
+	hd_dma_init();
+#endif
 	for (drive=0 ; drive<NR_HD ; drive++) {
 		if (!(bh = bread(0x300 + drive*5,0))) { // 读取硬盘引导区数据
 			printk("Unable to read partition table of drive %d\n\r",
@@ -170,6 +198,7 @@ int sys_setup(void * BIOS)
 	if (NR_HD)
 		printk("Partition table%s ok.\n\r",(NR_HD>1)?"s":"");
 	rd_load();
+	init_swapping();
 	mount_root();
 	return (0);
 }
@@ -232,6 +261,40 @@ static void hd_out(unsigned int drive,
 	outb(cmd,++port);
 }
 
+static void identify_intr(void)
+{
+}
+
+/*
+ * Ask the drive how many sectors it can move per interrupt, and if it
+ * can do dma. This is done by polling, before the drive is used through
+ * the request queue. Drives that don't know IDENTIFY just abort it.
+ */
+static void hd_identify(int drive)
+{
+	unsigned short id[256];
+	int i,r;
+
+	hd_mult[drive] = 0;
+	if (!controller_ready())
+		return;
+	hd_out(drive,0,0,0,0,WIN_IDENTIFY,&identify_intr);
+	for (i=0 ; i<100000 ; i++)
+		if (!((r = inb_p(HD_STATUS)) & BUSY_STAT))
+			break;
+	if ((r & (BUSY_STAT | ERR_STAT | DRQ_STAT)) != DRQ_STAT) {
+		if (r & ERR_STAT)
+			inb(HD_ERROR);
+		return;
+	}
+	port_read(HD_DATA,id,256);
+	if ((i = MIN(id[47] & 0xff,MAX_SECTORS)) > 1) // word 47: 每次中断最多的扇区数
+		hd_mult[drive] = i;
+#ifdef HD_DMA
+	hd_dma[drive] = (id[49] & 0x100) != 0;        // word 49 bit 8: 支持DMA
+#endif
+}
+
 static int drive_busy(void)
 {
 	unsigned int i;
@@ -280,44 +343,103 @@ static void bad_rw_intr(void)
 		reset = 1;
 }
 
+/*
+ * A request may span several buffers. Each interrupt moves a block of
+ * hd_xfer sectors (less at the end of the request); next_sector() is
+ * called once for each of them. When the current buffer is full it is
+ * handed back with end_request(), which moves CURRENT->buffer on to
+ * the next one. Returns the number of sectors still to go.
+ */
+#define hd_block() MIN(hd_xfer,CURRENT->nr_sectors)
+
+static int next_sector(void)
+{
+	int left;
+
+	CURRENT->buffer += 512;
+	CURRENT->sector++;
+	left = --CURRENT->nr_sectors;
+	if (!--CURRENT->current_nr_sectors)
+		end_request(1); // 一个缓冲块完成了
+	return left;
+}
+
+/*
+ * Write the next block to the controller. The sectors stay in the
+ * request until the drive says they are written, so we can't use
+ * next_sector() here: walk the buffer chain by hand.
+ */
+static void write_block(void)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	char * p = CURRENT->buffer;
+	int cur = CURRENT->current_nr_sectors;
+	int i = hd_block();
+
+	while (i--) {
+		port_write(HD_DATA,p,256);
+		p += 512;
+		if (!--cur && bh && (bh = bh->b_reqnext)) {
+			p = bh->b_data;
+			cur = 2;
+		}
+	}
+}
+
 static void read_intr(void)
 {
+	int i,left;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
 
-	port_read(HD_DATA,CURRENT->buffer,256); // 从控制器缓冲区读取一个扇区的数据
-	CURRENT->errors = 0;
-	CURRENT->buffer += 512;
-	CURRENT->sector++;
-	if (--CURRENT->nr_sectors) { // 数据没有读取完成, 继续进行
+	i = hd_block();
+	do {
+		port_read(HD_DATA,CURRENT->buffer,256); // 从控制器缓冲区读取一个扇区的数据
+		CURRENT->errors = 0;
+		left = next_sector();
+	} while (--i && left);
+	if (left) { // 数据没有读取完成, 继续进行
 		do_hd = &read_intr;
 		return;
 	}
-	end_request(1);   // 完成当前一个请求
 	do_hd_request();  // 当前请求完成了, 接下来处理下一个请求, 发生下一个请求给硬盘控制器
 }
 
 static void write_intr(void)
 {
+	int i,left;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++;
-		CURRENT->buffer += 512;
+	i = hd_block();
+	do
+		left = next_sector();
+	while (--i && left);
+	if (left) {
 		do_hd = &write_intr;
-		port_write(HD_DATA,CURRENT->buffer,256);
+		write_block();
 		return;
 	}
-	end_request(1);  // 完成当前一个请求
 	do_hd_request(); // 处理下一个请求
 }
 
+static void setmult_intr(void)
+{
+	if (win_result()) {
+		printk("hd%d: set multiple failed, using single sectors\n\r",
+			CURRENT_DEV);
+		hd_mult[CURRENT_DEV] = 0;
+	}
+	do_hd_request();
+}
+
 static void recal_intr(void)
 {
 	if (win_result())
@@ -325,6 +447,162 @@ static void recal_intr(void)
 	do_hd_request();
 }
 
+#ifdef HD_DMA
+/*
+ * PCI IDE bus-master dma. The controller is found by its class code
+ * (0x0101) on pci bus 0, and BAR4 gives the bus-master registers. Only
+ * the primary channel is used, as that is the one we drive.
+ *
+ * The controller reads a table of (address, count) pairs, the PRD
+ * table, and moves the whole request without any help. An entry may
+ * not cross a 64kB boundary. Our buffers are identity mapped, so their
+ * addresses can be handed over as they are.
+ */
+#define BM_CMD		0	/* bus-master register offsets */
+#define BM_STATUS	2
+#define BM_PRD		4
+
+#define BM_START	0x01
+#define BM_READ		0x08	/* device to memory */
+#define BM_ERR		0x02
+#define BM_INTR		0x04
+
+#define PRD_EOT		0x80000000
+#define NR_PRD		(PAGE_SIZE/8)
+
+#define PCI_ADDR(dev,fn,reg) \
+	(0x80000000 | ((dev)<<11) | ((fn)<<8) | ((reg) & 0xfc))
+
+static unsigned short bm_base = 0;	/* 0 - no controller, use pio */
+static unsigned long * prd_table = NULL;
+
+static unsigned long pci_read(int dev, int fn, int reg)
+{
+	outl(PCI_ADDR(dev,fn,reg),0xCF8);
+	return inl(0xCFC);
+}
+
+static void pci_write(int dev, int fn, int reg, unsigned long val)
+{
+	outl(PCI_ADDR(dev,fn,reg),0xCF8);
+	outl(val,0xCFC);
+}
+
+static void hd_dma_init(void)
+{
+	int dev,fn;
+	unsigned long bar;
+
+	for (dev=0 ; dev<32 ; dev++)
+		for (fn=0 ; fn<8 ; fn++) {
+			if ((pci_read(dev,fn,0) & 0xffff) == 0xffff) {
+				if (!fn)
+					break;	// 没有这个设备
+				continue;
+			}
+			if ((pci_read(dev,fn,0x08) >> 16) != 0x0101)
+				continue;
+			bar = pci_read(dev,fn,0x20);
+			if (!(bar & 1) || !(bar & 0xfff0))
+				continue;
+			/* enable i/o decoding and bus mastering */
+			pci_write(dev,fn,0x04,(pci_read(dev,fn,0x04) & 0xffff) | 5);
+			if (!(prd_table = (unsigned long *) get_free_page()))
+				return;
+			bm_base = bar & 0xfff0;
+			printk("hd: bus-master dma at %04x\n\r",bm_base);
+			return;
+		}
+}
+
+static int prd_add(int n, unsigned long addr, unsigned long len)
+{
+	unsigned long chunk;
+
+	while (len) {
+		chunk = 0x10000 - (addr & 0xffff);
+		if (chunk > len)
+			chunk = len;
+		if (n && (addr & 0xffff) &&
+		    prd_table[2*n-2] + prd_table[2*n-1] == addr)
+			prd_table[2*n-1] += chunk;	// 与上一项连续, 合并
+		else {
+			if (n >= NR_PRD)
+				return -1;
+			prd_table[2*n] = addr;
+			prd_table[2*n+1] = chunk;
+			n++;
+		}
+		addr += chunk;
+		len -= chunk;
+	}
+	return n;
+}
+
+/*
+ * Build the PRD table for what is left of CURRENT. A count of 64kB is
+ * written as 0, so that is done last.
+ */
+static int build_prd(void)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	int i,n;
+
+	if (!bh)
+		n = prd_add(0,(unsigned long) CURRENT->buffer,
+			CURRENT->nr_sectors<<9);
+	else {
+		n = prd_add(0,(unsigned long) CURRENT->buffer,
+			CURRENT->current_nr_sectors<<9);
+		while (n > 0 && (bh = bh->b_reqnext))
+			n = prd_add(n,(unsigned long) bh->b_data,BLOCK_SIZE);
+	}
+	if (n <= 0)
+		return 0;
+	for (i=0 ; i<n ; i++)
+		prd_table[2*i+1] &= 0xffff;
+	prd_table[2*n-1] |= PRD_EOT;
+	return n;
+}
+
+static void dma_intr(void)
+{
+	int i,stat;
+
+	stat = inb(bm_base+BM_STATUS);
+	outb(0,bm_base+BM_CMD);
+	outb(BM_ERR|BM_INTR,bm_base+BM_STATUS);
+	if (win_result() || (stat & BM_ERR)) {
+		printk("hd%d: dma failed, using pio\n\r",CURRENT_DEV);
+		hd_dma[CURRENT_DEV] = 0;
+		bad_rw_intr();
+		do_hd_request();
+		return;
+	}
+	// 整个请求都传输完了, 逐个缓冲块结束
+	for (i=CURRENT->nr_sectors ; i>0 ; i--)
+		next_sector();
+	do_hd_request();
+}
+
+static int hd_dma_start(unsigned int drive, unsigned int nsect,
+	unsigned int sec, unsigned int head, unsigned int cyl)
+{
+	int read = (CURRENT->cmd == READ);
+
+	if (!bm_base || !hd_dma[drive] || !build_prd())
+		return 0;
+	outb(0,bm_base+BM_CMD);
+	outl((unsigned long) prd_table,bm_base+BM_PRD);
+	outb(BM_ERR|BM_INTR,bm_base+BM_STATUS);
+	outb(read ? BM_READ : 0,bm_base+BM_CMD);
+	hd_out(drive,nsect,sec,head,cyl,
+		read ? WIN_READDMA : WIN_WRITEDMA,&dma_intr);
+	outb((read ? BM_READ : 0) | BM_START,bm_base+BM_CMD);
+	return 1;
+}
+#endif
+
 void do_hd_request(void)
 {
 	int i,r = 0;
@@ -336,7 +614,8 @@ void do_hd_request(void)
 
 	dev = MINOR(CURRENT->dev); // 次设备号(分区号)
 	block = CURRENT->sector;   // 要读取的扇区
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) {
+	nsect = CURRENT->nr_sectors;
+	if (dev >= 5*NR_HD || block+nsect > hd[dev].nr_sects) {
 		end_request(0);
 		goto repeat;
 	}
@@ -354,10 +633,10 @@ void do_hd_request(void)
 		"r" (hd_info[dev].head));
 
 	sec++;
-	nsect = CURRENT->nr_sectors;
 	if (reset) {
 		reset = 0;
 		recalibrate = 1;
+		need_setmult = (1<<MAX_HD)-1;
 		reset_hd(CURRENT_DEV);
 		return;
 	}
@@ -367,9 +646,22 @@ void do_hd_request(void)
 			WIN_RESTORE,&recal_intr);
 		return;
 	}
+	if (need_setmult & (1<<dev)) {
+		need_setmult &= ~(1<<dev);
+		if (hd_mult[dev]) {
+			hd_out(dev,hd_mult[dev],0,0,0,WIN_SETMULT,&setmult_intr);
+			return;
+		}
+	}
 
+#ifdef HD_DMA
+	if (hd_dma_start(dev,nsect,sec,head,cyl))
+		return;
+#endif
+	hd_xfer = hd_mult[dev] ? hd_mult[dev] : 1;
 	if (CURRENT->cmd == WRITE) { // 1) 写命令
-		hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTWRITE : WIN_WRITE,&write_intr);
 		// 查询控制器是否同意接受写数据操作
 		for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
 			/* nothing */ ;
@@ -378,10 +670,11 @@ void do_hd_request(void)
 			goto repeat;
 		}
 		// 写到控制器缓冲区(CURRENT->buffer是线性地址, 但被映射到相同的物理地址中)
-		port_write(HD_DATA,CURRENT->buffer,256);
+		write_block();
 
 	} else if (CURRENT->cmd == READ) { // 2) 读命令
-		hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTREAD : WIN_READ,&read_intr);
 	} else
 		panic("unknown hd-command");
 }
@@ -390,6 +683,7 @@ void hd_init(void)
 {
 	// 设置设备驱动函数
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;
+	blk_dev[MAJOR_NR].elevator = &deadline_elevator;
 	set_intr_gate(0x2E,&hd_interrupt); // 设置中断回调函数
 	// 允许硬盘中断
 	outb_p(inb_p(0x21)&0xfb,0x21);
@@ -20,14 +20,12 @@
  */
 struct request request[NR_REQUEST];
 
-/*
- * used to wait on when there are no free requests
- */
-struct task_struct * wait_for_request = NULL;
+static int nr_requests[NR_BLK_DEV] = BLK_REQUESTS;
 
 /* blk_dev_struct is:
  *	do_request-address
  *	next-request
+ * the rest is set up by blk_dev_init() and the drivers
  */
 struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
 	{ NULL, NULL },		/* no_dev */
@@ -72,6 +70,85 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait);
 }
 
+/*
+ * C-LOOK: insert req into the sorted sweep it belongs to. The queue
+ * goes up from the current request, wraps once to the lowest sector,
+ * and goes up again. Nothing is ever put in front of the current one.
+ */
+static void clook_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp = dev->current_request;
+
+	for ( ; tmp->next ; tmp=tmp->next) {
+		if (IN_ORDER(tmp,req) && IN_ORDER(req,tmp->next))
+			break;
+		if (!IN_ORDER(tmp,tmp->next) &&		// 回绕点
+		    (IN_ORDER(tmp,req) || IN_ORDER(req,tmp->next)))
+			break;
+	}
+	req->next=tmp->next;
+	tmp->next=req;
+}
+
+static struct request * clook_next(struct blk_dev_struct * dev)
+{
+	return dev->current_request->next;
+}
+
+struct elevator clook_elevator = { "c-look", clook_add, clook_next };
+
+/*
+ * deadline: C-LOOK, but every request also gets an expiry time. Reads
+ * get a short one, as somebody is usually waiting for them. When a
+ * request has expired, the queue is rotated so that the sweep goes on
+ * from the oldest expired request.
+ */
+#define READ_EXPIRE	(HZ/2)
+#define WRITE_EXPIRE	(5*HZ)
+
+static void deadline_add(struct blk_dev_struct * dev, struct request * req)
+{
+	req->deadline = jiffies + (req->cmd == READ ? READ_EXPIRE : WRITE_EXPIRE);
+	clook_add(dev,req);
+}
+
+static struct request * deadline_next(struct blk_dev_struct * dev)
+{
+	struct request * head = dev->current_request;
+	struct request * req, * prev, * last;
+	struct request * old = NULL, * oldprev = NULL;
+
+	for (prev = head ; (req = prev->next) ; prev = req)
+		if ((long) (req->deadline - jiffies) <= 0 &&
+		    (!old || (long) (req->deadline - old->deadline) < 0)) {
+			old = req;
+			oldprev = prev;
+		}
+	if (!old || oldprev == head)
+		return head->next;
+	dev->nr_expired++;
+	for (last = old ; last->next ; last = last->next)
+		/* nothing */ ;
+	last->next = head->next;
+	oldprev->next = NULL;
+	return old;
+}
+
+struct elevator deadline_elevator = { "deadline", deadline_add, deadline_next };
+
+/*
+ * next_request() is called when the current request is done, with
+ * interrupts off. It returns the request to start next.
+ */
+struct request * next_request(struct blk_dev_struct * dev)
+{
+	struct request * req;
+
+	if ((req = (dev->elevator->next)(dev)) && req->dev >= 0)
+		dev->nr_dispatch++;
+	return req;
+}
+
 /*
  * add-request adds a request to the linked list.
  * It disables interrupts so that it can muck with the
@@ -79,30 +156,95 @@ static inline void unlock_buffer(struct buffer_head * bh)
  */
 static void add_request(struct blk_dev_struct * dev, struct request * req)
 {
-	struct request * tmp;
-
 	req->next = NULL;
 	cli();  // 防止IO中断影响请求队列
 	if (req->bh)
 		req->bh->b_dirt = 0;
-	if (!(tmp = dev->current_request)) {
+	if (!dev->current_request) {
 		dev->current_request = req;
+		dev->nr_dispatch++;
 		sti();
 		(dev->request_fn)();
 		return;
 	}
-	for ( ; tmp->next ; tmp=tmp->next)
-		if ((IN_ORDER(tmp,req) ||
-		    !IN_ORDER(tmp,tmp->next)) &&
-		    IN_ORDER(req,tmp->next))
-			break;
-	req->next=tmp->next;
-	tmp->next=req;
+	(dev->elevator->add)(dev,req);
 	sti(); // 打开中断
 }
 
+/*
+ * ll_rw_block() "plugs" an idle device while it queues a batch of
+ * buffers: a dummy request (dev == -1) sits at the head of the queue,
+ * so the driver isn't started and the buffers get a chance to merge.
+ * Anybody about to sleep on the queue has to pull the plug first, or
+ * he might wait for something that never gets started.
+ */
+static void unplug_device(struct blk_dev_struct * dev)
+{
+	struct request * req;
+
+	cli();
+	if ((req = dev->current_request) && req->dev < 0) {
+		dev->current_request = next_request(dev);
+		if (dev->current_request) {
+			sti();
+			(dev->request_fn)();
+			return;
+		}
+	}
+	sti();
+}
+
+/*
+ * Only the hd and the ramdisk know how to handle a request that
+ * spans several buffers. The floppy does one block at a time.
+ */
+#define CAN_MERGE(major) ((major) == 1 || (major) == 3)
+
+/*
+ * Try to attach bh to a queued request for the sectors just before
+ * or after it. The first request is left alone: the driver may
+ * already be working on it.
+ */
+static int merge_request(struct blk_dev_struct * dev, int rw,
+	struct buffer_head * bh)
+{
+	struct request * req;
+	unsigned long sector = bh->b_blocknr<<1;
+
+	cli();
+	if (!(req = dev->current_request)) {
+		sti();
+		return 0;
+	}
+	while ((req = req->next)) {
+		if (req->dev != bh->b_dev || req->cmd != rw || !req->bh ||
+		    req->nr_sectors+2 > MAX_SECTORS)
+			continue;
+		if (req->sector + req->nr_sectors == sector) { // 接在请求后面
+			bh->b_reqnext = NULL;
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+		} else if (req->sector == sector+2) {          // 插在请求前面
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->buffer = bh->b_data;
+			req->current_nr_sectors = 2;
+			req->sector = sector;
+		} else
+			continue;
+		req->nr_sectors += 2;
+		dev->nr_merge++;
+		bh->b_dirt = 0;
+		sti();
+		return 1;
+	}
+	sti();
+	return 0;
+}
+
 static void make_request(int major,int rw, struct buffer_head * bh)
 {
+	struct blk_dev_struct * dev;
 	struct request * req;
 	int rw_ahead;
 
@@ -118,68 +260,200 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 	}
 	if (rw!=READ && rw!=WRITE)
 		panic("Bad block dev command, must be R/W/RA/WA");
+	dev = major+blk_dev;
+	if (bh->b_lock)  // 有可能在等我们插在队列头的请求, 先拔掉
+		unplug_device(dev);
 	lock_buffer(bh); // 锁着缓冲块, 防止其他进程对其进行修改
 	if ((rw == WRITE && !bh->b_dirt) || (rw == READ && bh->b_uptodate)) {
 		unlock_buffer(bh);
 		return;
 	}
+	if (CAN_MERGE(major) && merge_request(dev,rw,bh))
+		return;
 repeat:
 /* we don't allow the write-requests to fill up the queue completely:
  * we want some room for reads: they take precedence. The last third
  * of the requests are only for reads.
  */
-// 这里有bug, 当找不到空闲的请求, 但还没有执行sleep_on()的时候发生了硬盘中断
-// 这时候硬盘中断程序会把当前请求设置为空闲并且唤醒等待空闲请求的进程,
-// 但此时当前进程并没有添加到等待队列中, 所以当回到本流程的时候会把当前进程添加到等待队列中,
-// 然后睡眠了, 所以此时就会出现当前进程一直睡眠不会被唤醒的情况
+// 从查找空闲请求到sleep_on()之间必须关中断: 否则硬盘中断可能在这之间
+// 释放一个请求并唤醒等待的进程, 而当前进程还没有进入等待队列,
+// 之后就会一直睡眠下去 (和lock_buffer()的情况一样)
 	if (rw == READ)
-		req = request+NR_REQUEST;
+		req = dev->requests+dev->nr_requests;
 	else
-		req = request+((NR_REQUEST*2)/3);
+		req = dev->requests+((dev->nr_requests*2)/3);
+	cli();
 /* find an empty request */
-	while (--req >= request)
+	while (--req >= dev->requests)
 		if (req->dev<0)
 			break;
 /* if none found, sleep on new requests: check for rw_ahead */
-	if (req < request) { // 找不到空闲的request
+	if (req < dev->requests) { // 找不到空闲的request
 		if (rw_ahead) {  // 如果是ahead操作, 直接返回
+			sti();
 			unlock_buffer(bh);
 			return;
 		}
-		sleep_on(&wait_for_request); // 否则等待有空闲的request
+		if (dev->current_request && dev->current_request->dev < 0) {
+			sti();
+			unplug_device(dev);  // 队列被塞住了, 先拔掉再找
+			goto repeat;
+		}
+		sleep_on(&dev->wait_for_request); // 否则等待有空闲的request
+		sti();
 		goto repeat;
 	}
 /* fill up the request-info, and add it to the queue */
 	req->dev = bh->b_dev;
+	sti();
 	req->cmd = rw;
 	req->errors=0;
 	req->sector = bh->b_blocknr<<1;
 	req->nr_sectors = 2;
+	req->current_nr_sectors = 2;
 	req->buffer = bh->b_data;
 	req->waiting = NULL;
+	req->uptodate = NULL;
 	req->bh = bh;
+	req->bhtail = bh;
+	bh->b_reqnext = NULL;
 	req->next = NULL;
-	add_request(major+blk_dev,req);
+	add_request(dev,req);
 }
 
-void ll_rw_block(int rw, struct buffer_head * bh)
+/*
+ * ll_rw_block() starts i/o on nr buffers, which must all be on the
+ * same device. Passing them in one call lets adjacent blocks end up
+ * in a single request.
+ */
+void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 {
 	unsigned int major;
+	struct blk_dev_struct * dev;
+	struct request plug;
+	int i,plugged = 0;
 
-	if ((major=MAJOR(bh->b_dev)) >= NR_BLK_DEV ||
+	if (nr <= 0)
+		return;
+	if ((major=MAJOR(bh[0]->b_dev)) >= NR_BLK_DEV ||
 	!(blk_dev[major].request_fn)) {
 		printk("Trying to read nonexistent block-device\n\r");
 		return;
 	}
-	make_request(major,rw,bh);
+	for (i=1 ; i<nr ; i++)
+		if (bh[i]->b_dev != bh[0]->b_dev) {
+			printk("ll_rw_block: buffers on different devices\n\r");
+			return;
+		}
+	dev = major+blk_dev;
+	if (nr > 1 && CAN_MERGE(major)) {
+		plug.dev = -1;
+		plug.cmd = -1;
+		plug.sector = 0;
+		plug.bh = NULL;
+		plug.next = NULL;
+		cli();
+		if (!dev->current_request) {
+			dev->current_request = &plug;
+			plugged = 1;
+		}
+		sti();
+	}
+	for (i=0 ; i<nr ; i++)
+		make_request(major,rw,bh[i]);
+	if (plugged)
+		unplug_device(dev);
+}
+
+/*
+ * Read or write one page straight to or from memory, without going
+ * through the buffer cache - this is what the swapper uses. There are
+ * no buffers in the request, so it's never merged with anything, and
+ * we sleep until the driver is done with it. Returns 1 if the page was
+ * read or written all right, 0 if not.
+ */
+int ll_rw_page(int rw, int dev, int page, char * buffer)
+{
+	struct blk_dev_struct * bdev;
+	struct request * req;
+	unsigned int major = MAJOR(dev);
+	int uptodate = 0;
+
+	if (major >= NR_BLK_DEV || !(blk_dev[major].request_fn)) {
+		printk("Trying to %s nonexistent block-device\n\r",
+			(rw == READ) ? "read" : "write");
+		return 0;
+	}
+	if (rw!=READ && rw!=WRITE)
+		panic("Bad block dev command, must be R/W");
+	bdev = major+blk_dev;
+repeat:
+	if (rw == READ)
+		req = bdev->requests+bdev->nr_requests;
+	else
+		req = bdev->requests+((bdev->nr_requests*2)/3);
+	cli();
+	while (--req >= bdev->requests)
+		if (req->dev<0)
+			break;
+	if (req < bdev->requests) {
+		if (bdev->current_request && bdev->current_request->dev < 0) {
+			sti();
+			unplug_device(bdev);
+			goto repeat;
+		}
+		sleep_on(&bdev->wait_for_request);
+		sti();
+		goto repeat;
+	}
+	req->dev = dev;
+	sti();
+	req->cmd = rw;
+	req->errors = 0;
+	req->sector = page<<3;
+	req->nr_sectors = 8;
+	req->current_nr_sectors = 8;
+	req->buffer = buffer;
+	req->bh = NULL;
+	req->bhtail = NULL;
+	req->next = NULL;
+	// end_request()的wake_up()会把我们唤醒
+	req->waiting = current;
+	req->uptodate = &uptodate;
+	current->state = TASK_UNINTERRUPTIBLE;
+	add_request(bdev,req);
+	schedule();
+	return uptodate;
 }
 
 void blk_dev_init(void)
 {
+	struct request * req;
 	int i;
 
 	for (i=0 ; i<NR_REQUEST ; i++) {
 		request[i].dev = -1;
 		request[i].next = NULL;
 	}
+	req = request;
+	for (i=0 ; i<NR_BLK_DEV ; i++) {
+		blk_dev[i].elevator = &clook_elevator; // 驱动程序可以在初始化时换成别的
+		blk_dev[i].requests = req;
+		blk_dev[i].nr_requests = nr_requests[i];
+		req += nr_requests[i];
+	}
+	if (req != request+NR_REQUEST)
+		panic("BLK_REQUESTS doesn't add up to NR_REQUEST");
+}
+
+void show_blk_stat(void)
+{
+	int i;
+
+	for (i=0 ; i<NR_BLK_DEV ; i++)
+		if (blk_dev[i].request_fn)
+			printk("blk %d (%s, %d requests): %d dispatched, %d merged, %d expired\n\r",
+				i,blk_dev[i].elevator->name,blk_dev[i].nr_requests,
+				blk_dev[i].nr_dispatch,blk_dev[i].nr_merge,
+				blk_dev[i].nr_expired);
 }
@@ -26,8 +26,9 @@ void do_rd_request(void)
 	char	*addr;
 
 	INIT_REQUEST;
+	/* one buffer at a time: the buffers of a request aren't contiguous */
 	addr = rd_start + (CURRENT->sector << 9);
-	len = CURRENT->nr_sectors << 9;
+	len = CURRENT->current_nr_sectors << 9;
 	if ((MINOR(CURRENT->dev) != 1) || (addr+len > rd_start+rd_length)) {
 		end_request(0);
 		goto repeat;
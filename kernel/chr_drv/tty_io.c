@@ -115,8 +115,10 @@ void tty_intr(struct tty_struct * tty, int mask)
 	if (tty->pgrp <= 0)
 		return;
 	for (i=0;i<NR_TASKS;i++)
-		if (task[i] && task[i]->pgrp==tty->pgrp)
+		if (task[i] && task[i]->pgrp==tty->pgrp) {
 			task[i]->signal |= mask;
+			signal_wake_up(task[i]);
+		}
 }
 
 static void sleep_if_empty(struct tty_queue * queue)
@@ -243,7 +245,7 @@ int tty_read(unsigned channel, char * buf, int nr)
 	if (time && !minimum) {
 		minimum=1;
 		if ((flag=(!oldalarm || time+jiffies<oldalarm)))
-			current->alarm = time+jiffies;
+			set_alarm(time+jiffies);
 	}
 	if (minimum>nr)
 		minimum=nr;
@@ -273,9 +275,9 @@ int tty_read(unsigned channel, char * buf, int nr)
 		} while (nr>0 && !EMPTY(tty->secondary));
 		if (time && !L_CANON(tty)) {
 			if ((flag=(!oldalarm || time+jiffies<oldalarm)))
-				current->alarm = time+jiffies;
+				set_alarm(time+jiffies);
 			else
-				current->alarm = oldalarm;
+				set_alarm(oldalarm);
 		}
 		if (L_CANON(tty)) {
 			if (b-buf)
@@ -283,7 +285,7 @@ int tty_read(unsigned channel, char * buf, int nr)
 		} else if (b-buf >= minimum)
 			break;
 	}
-	current->alarm = oldalarm;
+	set_alarm(oldalarm);
 	if (current->signal && !(b-buf))
 		return -EINTR;
 	return (b-buf);
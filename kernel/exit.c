@@ -15,21 +15,21 @@
 
 int sys_pause(void);
 int sys_close(int fd);
+void free_task_slot(int nr);
+void unhash_pid(struct task_struct * p);
 
 void release(struct task_struct * p)
 {
-	int i;
-
 	if (!p)
 		return;
-	for (i=1 ; i<NR_TASKS ; i++)
-		if (task[i]==p) {
-			task[i]=NULL;        // 清空p进程对应task数组的位置
-			free_page((long)p);  // 释放p进程描述符占用的内存页
-			schedule();          // 重新调度
-			return;
-		}
-	panic("trying to release non-existent task");
+	if (p->nr < 1 || p->nr >= NR_TASKS || task[p->nr] != p)
+		panic("trying to release non-existent task");
+	task[p->nr]=NULL;        // 清空p进程对应task数组的位置
+	unhash_pid(p);
+	free_task_slot(p->nr);
+	free_page(p->tss.cr3);   // 页目录(任务0和vfork的子进程是0, 不用释放)
+	free_page((long)p);      // 释放p进程描述符占用的内存页
+	schedule();              // 重新调度
 }
 
 // 向p进程发送sig信号
@@ -37,9 +37,10 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
 {
 	if (!p || sig<1 || sig>32)
 		return -EINVAL;
-	if (priv || (current->euid==p->euid) || suser())
+	if (priv || (current->euid==p->euid) || suser()) {
 		p->signal |= (1<<(sig-1));
-	else
+		signal_wake_up(p);
+	} else
 		return -EPERM;
 	return 0;
 }
@@ -50,8 +51,10 @@ static void kill_session(void)
 	struct task_struct **p = NR_TASKS + task;
 	
 	while (--p > &FIRST_TASK) {
-		if (*p && (*p)->session == current->session)
+		if (*p && (*p)->session == current->session) {
 			(*p)->signal |= 1<<(SIGHUP-1);
+			signal_wake_up(*p);
+		}
 	}
 }
 
@@ -62,16 +65,16 @@ static void kill_session(void)
 int sys_kill(int pid,int sig)
 {
 	struct task_struct **p = NR_TASKS + task;
+	struct task_struct *tsk;
 	int err, retval = 0;
 
 	if (!pid) while (--p > &FIRST_TASK) {
 		if (*p && (*p)->pgrp == current->pid) 
 			if ((err=send_sig(sig,*p,1)))
 				retval = err;
-	} else if (pid>0) while (--p > &FIRST_TASK) {
-		if (*p && (*p)->pid == pid) 
-			if ((err=send_sig(sig,*p,0)))
-				retval = err;
+	} else if (pid>0) {
+		if ((tsk = find_task_by_pid(pid)))
+			retval = send_sig(sig,tsk,0);
 	} else if (pid == -1) while (--p > &FIRST_TASK) {
 		if ((err = send_sig(sig,*p,0)))
 			retval = err;
@@ -85,17 +88,13 @@ int sys_kill(int pid,int sig)
 // 发送SIGCHLD信号给父进程pid, 只有exit()系统调用使用此函数
 static void tell_father(int pid)
 {
-	int i;
+	struct task_struct * p;
 
-	if (pid)
-		for (i=0;i<NR_TASKS;i++) {
-			if (!task[i])
-				continue;
-			if (task[i]->pid != pid)
-				continue;
-			task[i]->signal |= (1<<(SIGCHLD-1));
-			return;
-		}
+	if (pid && (p = find_task_by_pid(pid))) {
+		p->signal |= (1<<(SIGCHLD-1));
+		signal_wake_up(p);
+		return;
+	}
 /* if we don't find any fathers, we just release ourselves */
 /* This is not really OK. Must change it to make father 1 */
 	printk("BAD BAD - no father found\n\r");
@@ -105,9 +104,15 @@ static void tell_father(int pid)
 int do_exit(long code)
 {
 	int i;
+
+	del_timer(&current->alarm_timer);
 	// 释放当前进程占用的内存页表项
-	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	if (!release_vfork(1)) {
+		free_page_tables(current->tss.cr3,
+			get_base(current->ldt[1]),get_limit(0x0f));
+		free_page_tables(current->tss.cr3,
+			get_base(current->ldt[2]),get_limit(0x17));
+	}
 	// send SIGCHLD signal to children process
 	// 找到当前进程的所有子进程, 把子进程的父进程替换成进程init
 	for (i=0 ; i<NR_TASKS ; i++)
@@ -18,9 +18,93 @@
 #include <asm/system.h>
 
 extern void write_verify(unsigned long address);
+extern void ret_from_fork(void);
 
 long last_pid=0;
 
+/*
+ * The task[] slots in use, one bit each (task 0 is always there).
+ * slot_hint is the lowest word that may have a clear bit, so that
+ * finding a free slot doesn't have to go through all of task[].
+ */
+static unsigned long slot_map[NR_TASKS/32] = {1, };
+static int slot_hint = 0;
+
+/*
+ * Tasks by pid, for get_pid() and for kill() and friends.
+ * Zombies stay in here until release(), their pid isn't free yet.
+ */
+#define PIDHASH_SZ (NR_TASKS>>2)
+#define pid_hashfn(pid) ((unsigned long) (pid) % PIDHASH_SZ)
+
+static struct task_struct * pidhash[PIDHASH_SZ];
+
+static int get_task_slot(void)
+{
+	unsigned long free;
+	int nr;
+
+	for ( ; slot_hint < NR_TASKS/32 ; slot_hint++) {
+		if (!(free = ~slot_map[slot_hint]))
+			continue;
+		__asm__("bsfl %1,%0":"=r" (nr):"r" (free));
+		slot_map[slot_hint] |= 1 << nr;
+		return (slot_hint<<5) + nr;
+	}
+	return -EAGAIN;
+}
+
+void free_task_slot(int nr)
+{
+	if (nr < 1 || nr >= NR_TASKS)
+		panic("free_task_slot: bad slot");
+	slot_map[nr>>5] &= ~(1 << (nr & 31));
+	if ((nr>>5) < slot_hint)
+		slot_hint = nr>>5;
+}
+
+static void hash_pid(struct task_struct * p)
+{
+	struct task_struct ** head = pidhash + pid_hashfn(p->pid);
+
+	p->pid_next = *head;
+	*head = p;
+}
+
+void unhash_pid(struct task_struct * p)
+{
+	struct task_struct ** tmp = pidhash + pid_hashfn(p->pid);
+
+	for ( ; *tmp ; tmp = &(*tmp)->pid_next)
+		if (*tmp == p) {
+			*tmp = p->pid_next;
+			return;
+		}
+	printk("unhash_pid: pid %d not in hash\n\r",p->pid);
+}
+
+struct task_struct * find_task_by_pid(long pid)
+{
+	struct task_struct * p = pidhash[pid_hashfn(pid)];
+
+	while (p && p->pid != pid)
+		p = p->pid_next;
+	return p;
+}
+
+/*
+ * The pid is picked only once copy_process() has its task struct, and
+ * hashed before it can sleep again: the pid is free as long as nothing
+ * in the hash has it, so nobody else gets it meanwhile.
+ */
+static long get_pid(void)
+{
+	repeat:
+		if ((++last_pid)<0) last_pid=1;
+		if (find_task_by_pid(last_pid)) goto repeat;
+	return last_pid;
+}
+
 /**
  * 验证地址是否合法
  * @addr: 开始地址
@@ -55,30 +139,56 @@ int copy_mem(int nr,struct task_struct * p)
 	if (data_limit < code_limit)
 		panic("Bad data_limit");
 	// 新进程代码段和数据段的内存起始位置
-	// nr是进程号, 进程的数据段和代码段开始地址为(nr * 0x4000000)
-	// 0x4000000 == 67108864 == 64MB
-	new_data_base = new_code_base = nr * 0x4000000;
+	// 每个进程都有自己的页目录, 用户空间都从TASK_BASE(64MB)开始
+	new_data_base = new_code_base = TASK_BASE;
 	p->start_code = new_code_base;
 	// 设置ldt
 	set_base(p->ldt[1],new_code_base);
 	set_base(p->ldt[2],new_data_base);
+	if (!(p->tss.cr3 = new_page_dir()))
+		return -ENOMEM;
 	// 新进程映射到到旧进程的内存地址
-	if (copy_page_tables(old_data_base,new_data_base,data_limit)) {
+	if (copy_page_tables(current->tss.cr3,p->tss.cr3,
+	    old_data_base,new_data_base,data_limit)) {
 		printk("free_page_tables: from copy_mem\n");
-		free_page_tables(new_data_base,data_limit);
+		free_page_tables(p->tss.cr3,new_data_base,data_limit);
+		free_page(p->tss.cr3);
 		return -ENOMEM;
 	}
 	return 0;
 }
 
+/*
+ * A vfork()ed child doesn't get a copy of the page tables: it runs on
+ * its parent's page directory, and the parent sleeps until the child
+ * execs or exits. release_vfork() is called at that point. It returns 0
+ * if the memory is the child's own (nothing to do), otherwise it gives
+ * the child a new, empty page directory (or just the kernel's, if it is
+ * exiting) and wakes up the parent.
+ */
+int release_vfork(int exiting)
+{
+	unsigned long dir = 0;
+
+	if (!current->vfork)
+		return 0;
+	if (!exiting && !(dir = new_page_dir()))
+		oom();
+	current->tss.cr3 = dir;
+	load_cr3(dir);
+	current->vfork = 0;
+	wake_up(&current->vfork_wait);
+	return 1;
+}
+
 /*
  *  Ok, this is the main fork-routine. It copies the system process
  * information (task[nr]) and sets up the necessary registers. It
  * also copies the data segment in it's entirety.
  */
 int copy_process(
-		/* 下面参数由sys_fork()提供 */
-		int nr, long ebp, long edi, long esi, long gs,
+		/* 下面参数由sys_fork()/sys_vfork()提供 */
+		int vfork, int nr, long ebp, long edi, long esi, long gs,
 		/* 下面参数由system_call()中断提供, none是调用系统调用sys_fork()时压栈的eip */
 		long none, long ebx, long ecx, long edx,
 		long fs, long es, long ds,
@@ -88,51 +198,72 @@ int copy_process(
 	struct task_struct *p;
 	int i;
 	struct file *f;
+	long *stack;
+	long pid;
 
 	// 申请一个空白页(返回物理地址), 用于保存进程描述符
-	p = (struct task_struct *) get_free_page();
-	if (!p)
+	p = (struct task_struct *) __get_free_page(); // 任务结构会被整个复制, 不用清零
+	if (!p) {
+		free_task_slot(nr);
 		return -EAGAIN;
+	}
 	task[nr] = p;
 	// 完全复制父进程的所有字段(ldt也在这里被复制, 在copy_mem的时候设置ldt的基地址)
 	*p = *current;	/* NOTE! this doesn't copy the supervisor stack */
+	p->nr = nr;
 	p->state = TASK_UNINTERRUPTIBLE;
-	p->pid = last_pid;  // 设置进程pid
+	pid = p->pid = get_pid();  // 设置进程pid, 到hash_pid()之间不能睡眠
 	p->father = current->pid;  // 父进程pid
 	p->counter = p->priority;  // CPU可用时间片
 	p->signal = 0;  // 信号位图
 	p->alarm = 0;   // 时钟定时器
+	init_timer(&p->alarm_timer);	// 复制来的是父进程的定时器链表指针
 	p->leader = 0;		/* process leadership doesn't inherit */
 	p->utime = p->stime = 0;   // 内核态和用户态运行的时间
 	p->cutime = p->cstime = 0;
 	p->start_time = jiffies;  // 进程创建的时间
-	// 设置TSS结构体
-	p->tss.back_link = 0;
+	hash_pid(p);	// 占住这个pid, 下面的copy_mem()可能睡眠
+	if (current == task[0])   // 任务0不能睡眠, 只能fork
+		vfork = 0;
+	p->vfork = vfork;
+	p->vfork_wait = NULL;
+	p->fpu_counter = 0;
+	p->fpu_used = 0;
 	p->tss.esp0 = PAGE_SIZE + (long) p; // 内核态堆栈
 	p->tss.ss0 = 0x10;                  // 内核数据段(0 ~ 16MB)
-	p->tss.eip = eip;                   // fork()返回后运行的第一条指令
-	p->tss.eflags = eflags;             // eflags寄存器
-	p->tss.eax = 0;                     // 子进程fork()的返回值
-	p->tss.ecx = ecx;
-	p->tss.edx = edx;
-	p->tss.ebx = ebx;
-	p->tss.esp = esp;
-	p->tss.ebp = ebp;
-	p->tss.esi = esi;
-	p->tss.edi = edi;
-	p->tss.es = es & 0xffff;
-	p->tss.cs = cs & 0xffff;
-	p->tss.ss = ss & 0xffff;
-	p->tss.ds = ds & 0xffff;
-	p->tss.fs = fs & 0xffff;
-	p->tss.gs = gs & 0xffff;
 	p->tss.ldt = _LDT(nr);             // LDT的位置(指向GDT的偏移量)
-	p->tss.trace_bitmap = 0x80000000;
+/*
+ * The child's kernel stack gets the frame of the parent's system call,
+ * with the registers ret_from_fork (system_call.s) pops before it. So
+ * switch_to() starts it there, and it returns to user mode from fork()
+ * just like the parent, with 0 in eax.
+ */
+	stack = (long *) p->tss.esp0;
+	*--stack = ss & 0xffff;
+	*--stack = esp;
+	*--stack = eflags;
+	*--stack = cs & 0xffff;
+	*--stack = eip;                     // fork()返回后运行的第一条指令
+	*--stack = ds & 0xffff;
+	*--stack = es & 0xffff;
+	*--stack = fs & 0xffff;
+	*--stack = edx;
+	*--stack = ecx;
+	*--stack = ebx;
+	*--stack = 0;                       // eax: 子进程fork()的返回值
+	*--stack = gs & 0xffff;
+	*--stack = esi;
+	*--stack = edi;
+	*--stack = ebp;
+	p->tss.esp = (long) stack;
+	p->tss.eip = (long) ret_from_fork;
 
 	if (last_task_used_math == current) // 如果当前进程是最后一个使用协处理器的
 		__asm__("clts ; fnsave %0"::"m" (p->tss.i387));
-	if (copy_mem(nr,p)) {
+	if (!vfork && copy_mem(nr,p)) {
+		unhash_pid(p);
 		task[nr] = NULL;
+		free_task_slot(nr);
 		free_page((long) p);
 		return -EAGAIN;
 	}
@@ -145,26 +276,24 @@ int copy_process(
 		current->root->i_count++;
 	if (current->executable)
 		current->executable->i_count++;
-	// 设置TSS和LDT对应GDT项
-	set_tss_desc(gdt+(nr<<1)+FIRST_TSS_ENTRY,&(p->tss));
-	set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
-	p->state = TASK_RUNNING;	/* do this last, just in case */
-	return last_pid;
+	// 设置LDT对应GDT项
+	set_ldt_desc(gdt+nr+FIRST_LDT_ENTRY,&(p->ldt));
+	p->run_level = -1;
+	wake_up_process(p);	/* do this last, just in case */
+	// vfork: 等待子进程exec或者exit
+	while (p->vfork)
+		sleep_on(&p->vfork_wait);
+	return pid;
 }
 
 /*
- * 找到一个空的task struct结构(返回其对应task数组的下标), 并且设置新的last_pid
+ * 找到一个空的task struct结构(返回其对应task数组的下标)
+ *
+ * The slot is taken here already: copy_process() may sleep getting
+ * memory, and another fork mustn't find the same one meanwhile. It
+ * gives it back with free_task_slot() if it fails.
  */
 int find_empty_process(void)
 {
-	int i;
-
-	repeat:
-		if ((++last_pid)<0) last_pid=1;
-		for(i=0 ; i<NR_TASKS ; i++)
-			if (task[i] && task[i]->pid == last_pid) goto repeat;
-	for(i=1 ; i<NR_TASKS ; i++)
-		if (!task[i])
-			return i;
-	return -EAGAIN;
+	return get_task_slot();
 }
@@ -34,6 +34,13 @@ void show_task(int nr,struct task_struct * p)
 	printk("%d (of %d) chars free in kernel stack\n\r",i,j);
 }
 
+extern void show_buffer_hash(void);
+extern void show_blk_stat(void);
+extern void show_page_stat(void);
+extern void show_swap_stat(void);
+static void show_sched_stat(void);
+static void show_timer_stat(void);
+
 void show_stat(void)
 {
 	int i;
@@ -41,6 +48,12 @@ void show_stat(void)
 	for (i=0;i<NR_TASKS;i++)
 		if (task[i])
 			show_task(i,task[i]);
+	show_buffer_hash();
+	show_blk_stat();
+	show_page_stat();
+	show_swap_stat();
+	show_sched_stat();
+	show_timer_stat();
 }
 
 #define LATCH (1193180/HZ)
@@ -64,31 +77,225 @@ struct task_struct *last_task_used_math = NULL;
 
 struct task_struct * task[NR_TASKS] = {&(init_task.task), };
 
+/*
+ * The only tss, see switch_to(). Its esp0 is the kernel stack of the
+ * current task, the rest is set up by sched_init().
+ */
+struct tss_struct cpu_tss;
+
 long user_stack [ PAGE_SIZE>>2 ] ;
 
 struct {
 	long * a;
 	short b;
 	} stack_start = { & user_stack [PAGE_SIZE>>2] , 0x10 };
+static unsigned long math_traps = 0, math_switches = 0, math_eager = 0;
+
+/*
+ * Save the math state of the last task that used it, and load the one
+ * of task p (or a clean one, if it hasn't used math before).
+ */
+static void switch_math(struct task_struct * p)
+{
+	__asm__("fwait");
+	if (last_task_used_math) {
+		__asm__("fnsave %0"::"m" (last_task_used_math->tss.i387));
+	}
+	last_task_used_math=p;
+	math_switches++;
+	if (p->used_math) {
+		__asm__("frstor %0"::"m" (p->tss.i387));
+	} else {
+		__asm__("fninit"::);
+		p->used_math=1;
+	}
+}
+
 /*
  *  'math_state_restore()' saves the current math information in the
  * old math state array, and gets the new ones from the current task
  */
 void math_state_restore()
 {
+	math_traps++;
+	current->fpu_used = 1;
 	if (last_task_used_math == current)
 		return;
-	__asm__("fwait");
-	if (last_task_used_math) {
-		__asm__("fnsave %0"::"m" (last_task_used_math->tss.i387));
+	switch_math(current);
+}
+
+/*
+ * The math state is switched lazily: switch_to() sets TS, and the first
+ * math instruction traps to math_state_restore(). A task that uses the
+ * math unit every time it runs pays that trap every time, so once it has
+ * done so for more than FPU_EAGER time slices in a row its state is
+ * loaded right away when it is switched to.
+ *
+ * fpu_used says the task used the math unit in the slice that is just
+ * ending: math_state_restore() sets it, and so does loading the state
+ * eagerly (there is no trap to tell then). A slice without it starts
+ * the count again - holding on to the math state doesn't count. The
+ * eager slices are taken on trust, but fpu_counter is only a byte: it
+ * wraps round after 256 of them, and the task has to show again that
+ * it uses math. Set FPU_EAGER to 255 to never restore eagerly.
+ */
+#define FPU_EAGER 5
+
+static inline void eager_math(struct task_struct * prev,
+	struct task_struct * next)
+{
+	if (prev->fpu_used)
+		prev->fpu_counter++;
+	else
+		prev->fpu_counter = 0;
+	prev->fpu_used = 0;
+	if (next->fpu_counter > FPU_EAGER && next->used_math) {
+		next->fpu_used = 1;
+		if (next != last_task_used_math) {
+			clts();
+			switch_math(next);
+			math_eager++;
+		}
+	}
+}
+
+/*
+ * The run queues. Every runnable task except current and the idle task
+ * sits on run_queue[counter] (the last level takes everything above it),
+ * and bit n of run_bitmap is set while level n isn't empty - so finding
+ * the task with the largest counter is a single bsrl. Tasks on the same
+ * level go round in turn.
+ *
+ * When all runnable tasks have used up their counters, the old code
+ * walked all of task[] doing counter = counter/2 + priority. Now only
+ * the runnable tasks (which are all on level 0 then) are done at once
+ * and a new epoch starts; a sleeping task catches up on the epochs it
+ * has missed when it is woken up.
+ *
+ * The run queues are changed from interrupts (wake_up()), so every
+ * change is done with interrupts off.
+ */
+#define NR_RUN_LEVELS 32
+#define RUN_LEVEL(p) ((p)->counter < NR_RUN_LEVELS ? (p)->counter : \
+	NR_RUN_LEVELS-1)
+
+static struct task_struct * run_queue[NR_RUN_LEVELS];
+static unsigned long run_bitmap = 0;
+static unsigned long epoch = 0;
+static unsigned long nr_switches = 0, nr_cr3_loads = 0, nr_recalcs = 0;
+
+static inline void enqueue_task(struct task_struct * p)
+{
+	struct task_struct ** head = run_queue + (p->run_level = RUN_LEVEL(p));
+
+	if (*head) {
+		p->run_next = *head;
+		p->run_prev = (*head)->run_prev;
+		p->run_prev->run_next = p;
+		(*head)->run_prev = p;
+	} else {
+		*head = p->run_next = p->run_prev = p;
+		run_bitmap |= 1 << p->run_level;
 	}
-	last_task_used_math=current;
-	if (current->used_math) {
-		__asm__("frstor %0"::"m" (current->tss.i387));
+}
+
+static inline void dequeue_task(struct task_struct * p)
+{
+	struct task_struct ** head = run_queue + p->run_level;
+
+	if (p->run_next == p) {
+		*head = NULL;
+		run_bitmap &= ~(1 << p->run_level);
 	} else {
-		__asm__("fninit"::);
-		current->used_math=1;
+		p->run_next->run_prev = p->run_prev;
+		p->run_prev->run_next = p->run_next;
+		if (*head == p)
+			*head = p->run_next;
+	}
+	p->run_level = -1;
+}
+
+/*
+ * Give the tasks on level 0 new counters and start a new epoch. Their
+ * counters are 0, so counter/2 + priority is just priority.
+ */
+static void recalc_counters(void)
+{
+	struct task_struct * p, * next, * first;
+
+	first = p = run_queue[0];
+	run_queue[0] = NULL;
+	run_bitmap &= ~1;
+	epoch++;
+	nr_recalcs++;
+	do {
+		next = p->run_next;
+		p->counter = p->priority;
+		p->epoch = epoch;
+		enqueue_task(p);
+	} while ((p = next) != first);
+}
+
+/*
+ * Put a task on its run queue - the one thing anybody should do to make
+ * a task runnable. current is left alone: schedule() puts it back on a
+ * queue itself.
+ */
+void wake_up_process(struct task_struct * p)
+{
+	unsigned long flags;
+	int n;
+
+	if (p->state == TASK_ZOMBIE)	// 僵死进程可能还留在等待队列里
+		return;
+	save_flags(flags);
+	cli();
+	p->state = TASK_RUNNING;
+	if (p != current && p != task[0] && p->run_level < 0) {
+		// 补上睡眠期间错过的重新计算 (8次以后counter已经不变了)
+		n = (epoch - p->epoch > 8) ? 8 : epoch - p->epoch;
+		while (n-- > 0)
+			p->counter = (p->counter >> 1) + p->priority;
+		p->epoch = epoch;
+		enqueue_task(p);
 	}
+	restore_flags(flags);
+}
+
+/*
+ * Called after a signal has been posted to p: an interruptible sleep
+ * ends if the signal isn't blocked. (schedule() used to check this for
+ * every task, every time.)
+ */
+void signal_wake_up(struct task_struct * p)
+{
+	if ((p->signal & ~(_BLOCKABLE & p->blocked)) &&
+	    p->state == TASK_INTERRUPTIBLE)
+		wake_up_process(p);
+}
+
+/*
+ * Each task has a timer for its alarm, so nobody has to go through all
+ * the tasks looking for alarms that are due.
+ */
+static void alarm_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->alarm = 0;
+	p->signal |= (1<<(SIGALRM-1));
+	signal_wake_up(p);
+}
+
+void set_alarm(long when)
+{
+	current->alarm = when;
+	current->alarm_timer.function = alarm_timeout;
+	current->alarm_timer.data = (unsigned long) current;
+	if (when)
+		mod_timer(&current->alarm_timer,when);
+	else
+		del_timer(&current->alarm_timer);
 }
 
 /*
@@ -105,48 +312,53 @@ void math_state_restore()
 // 只有用户态才会在do_timer()的时候主动调用schedule()
 void schedule(void)
 {
-	int i,next,c;
-	struct task_struct ** p;
-
-/* check alarm, wake up any interruptible tasks that have got a signal */
-
-	for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-		if (*p) {
-			if ((*p)->alarm && (*p)->alarm < jiffies) {
-				(*p)->signal |= (1<<(SIGALRM-1));
-				(*p)->alarm = 0;
-			}
-			// 如果进程接收到信号, 而且信号不被阻塞
-			// 而且进程处于可中断状态, 那么把进程设置为可运行状态
-			if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) &&
-			(*p)->state==TASK_INTERRUPTIBLE)
-				(*p)->state=TASK_RUNNING;
-		}
+	struct task_struct * prev = current, * next;
+	unsigned long flags;
+	int level;
+
+	save_flags(flags);
+	cli();
+	// 睡眠之前就有信号了, 不用睡了
+	if (prev->state == TASK_INTERRUPTIBLE &&
+	    (prev->signal & ~(_BLOCKABLE & prev->blocked)))
+		prev->state = TASK_RUNNING;
+	if (prev->run_level >= 0)
+		dequeue_task(prev);
+	if (prev->state == TASK_RUNNING && prev != task[0])
+		enqueue_task(prev);
 
 /* this is the scheduler proper: */
 
-	while (1) {
-		c = -1;  // 这个是用于判断是否使用idle进程的技巧(task0)
-		next = 0;
-		i = NR_TASKS;
-		p = &task[NR_TASKS];
-		while (--i) {
-			if (!*--p)
-				continue;
-			if ((*p)->state == TASK_RUNNING && (*p)->counter > c)
-				c = (*p)->counter, next = i;
-		}
-		if (c) break; // 如果c等于-1也会跳出循环, 此时将会使用idle进程
-		for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-			if (*p)
-				(*p)->counter = ((*p)->counter >> 1) +
-						(*p)->priority;
+	if (run_bitmap == 1)	// 可运行的进程时间片都用完了
+		recalc_counters();
+	if (run_bitmap) {
+		__asm__("bsrl %1,%0":"=r" (level):"r" (run_bitmap));
+		next = run_queue[level];
+		dequeue_task(next);
+	} else
+		next = task[0];	// 没有可运行的进程, 使用idle进程
+	if (next != prev) {
+		nr_switches++;
+		if (next->tss.cr3 != prev->tss.cr3)
+			nr_cr3_loads++;
+		eager_math(prev,next);
 	}
-	switch_to(next);
+	switch_to(next->nr);
+	restore_flags(flags);
+}
+
+static void show_sched_stat(void)
+{
+	printk("%d task switches (%d loaded cr3), %d counter recalculations\n\r",
+		nr_switches,nr_cr3_loads,nr_recalcs);
+	printk("%d math traps, %d math state switches (%d eager)\n\r",
+		math_traps,math_switches,math_eager);
 }
 
 int sys_pause(void)
 {
+	if (current == task[0])	// 空闲时顺便准备清零的页面
+		fill_zero_pool();
 	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	return 0;
@@ -165,7 +377,7 @@ void sleep_on(struct task_struct **p)
 	current->state = TASK_UNINTERRUPTIBLE;
 	schedule();
 	if (tmp)
-		tmp->state=0;
+		wake_up_process(tmp);
 }
 
 void interruptible_sleep_on(struct task_struct **p)
@@ -181,19 +393,19 @@ void interruptible_sleep_on(struct task_struct **p)
 repeat:	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	if (*p && *p != current) {
-		(**p).state=0;
+		wake_up_process(*p);
 		goto repeat;
 	}
 	// 到达此处说明等待队列头为空, 或者是当前进程
 	*p=NULL;
 	if (tmp)
-		tmp->state=0;
+		wake_up_process(tmp);
 }
 
 void wake_up(struct task_struct **p)
 {
 	if (p && *p) {
-		(**p).state=0;
+		wake_up_process(*p);
 		*p=NULL; // 将等待队列头结点设置为NULL, 后面由各个进程唤醒之前等待的进程
 	}
 }
@@ -266,45 +478,165 @@ void do_floppy_timer(void)
 	}
 }
 
-#define TIME_REQUESTS 64
+/*
+ * The timer wheel. tv1 has a list for each of the next 256 jiffies,
+ * tv2 a list for each of the next 64 blocks of 256 jiffies, tv3 for
+ * blocks of 64*256 jiffies, and so on - five of them cover all 32 bits.
+ * Adding or deleting a timer is just putting it on or taking it off
+ * its list. Each time tv1 has gone round, the next list of tv2 is
+ * spread out over tv1, and when tv2 has gone round, the next list of
+ * tv3 over tv2 etc ("cascading"), so a timer is moved at most four
+ * times before it runs.
+ *
+ * timer_jiffies is the time the wheel is at: run_timers() runs it up
+ * to jiffies. All of this is done with interrupts off.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+struct timer_vec {
+	int index;
+	struct timer_list * vec[TVN_SIZE];
+};
+
+struct timer_vec_root {
+	int index;
+	struct timer_list * vec[TVR_SIZE];
+};
+
+static struct timer_vec tv5, tv4, tv3, tv2;
+static struct timer_vec_root tv1;
+
+#define NOOF_TVECS 5
+static struct timer_vec * const tvecs[NOOF_TVECS] = {
+	(struct timer_vec *) &tv1, &tv2, &tv3, &tv4, &tv5
+};
 
-static struct timer_list {
-	long jiffies;
-	void (*fn)();
-	struct timer_list * next;
-} timer_list[TIME_REQUESTS], * next_timer = NULL;
+static unsigned long timer_jiffies = 0;
+static unsigned long timers_added = 0, timers_run = 0, timers_cascaded = 0;
 
-void add_timer(long jiffies, void (*fn)(void))
+static void internal_add_timer(struct timer_list * timer)
 {
-	struct timer_list * p;
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+	struct timer_list ** vec;
+
+	if (idx < TVR_SIZE)
+		vec = tv1.vec + (expires & TVR_MASK);
+	else if (idx < 1 << (TVR_BITS + TVN_BITS))
+		vec = tv2.vec + ((expires >> TVR_BITS) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 2*TVN_BITS))
+		vec = tv3.vec + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 3*TVN_BITS))
+		vec = tv4.vec + ((expires >> (TVR_BITS + 2*TVN_BITS)) & TVN_MASK);
+	else if ((long) idx < 0)	// 已经过期了, 下一个tick就运行
+		vec = tv1.vec + tv1.index;
+	else
+		vec = tv5.vec + ((expires >> (TVR_BITS + 3*TVN_BITS)) & TVN_MASK);
+	if ((timer->next = *vec))
+		(*vec)->pprev = &timer->next;
+	*vec = timer;
+	timer->pprev = vec;
+}
 
-	if (!fn)
-		return;
+static inline void detach_timer(struct timer_list * timer)
+{
+	if ((*timer->pprev = timer->next))
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+void add_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+
+	save_flags(flags);
 	cli();
-	if (jiffies <= 0)
-		(fn)();
+	if (timer_pending(timer))
+		printk("add_timer: timer already added\n\r");
 	else {
-		for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++)
-			if (!p->fn)
-				break;
-		if (p >= timer_list + TIME_REQUESTS)
-			panic("No more time requests free");
-		p->fn = fn;
-		p->jiffies = jiffies;
-		p->next = next_timer;
-		next_timer = p;
-		while (p->next && p->next->jiffies < p->jiffies) {
-			p->jiffies -= p->next->jiffies;
-			fn = p->fn;
-			p->fn = p->next->fn;
-			p->next->fn = fn;
-			jiffies = p->jiffies;
-			p->jiffies = p->next->jiffies;
-			p->next->jiffies = jiffies;
-			p = p->next;
+		internal_add_timer(timer);
+		timers_added++;
+	}
+	restore_flags(flags);
+}
+
+int del_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	save_flags(flags);
+	cli();
+	if (timer_pending(timer)) {
+		detach_timer(timer);
+		ret = 1;
+	}
+	restore_flags(flags);
+	return ret;
+}
+
+void mod_timer(struct timer_list * timer, unsigned long expires)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (timer_pending(timer))
+		detach_timer(timer);
+	timer->expires = expires;
+	internal_add_timer(timer);
+	timers_added++;
+	restore_flags(flags);
+}
+
+static void cascade_timers(struct timer_vec * tv)
+{
+	struct timer_list * timer, * next;
+
+	timer = tv->vec[tv->index];
+	tv->vec[tv->index] = NULL;
+	while (timer) {
+		next = timer->next;
+		internal_add_timer(timer);
+		timers_cascaded++;
+		timer = next;
+	}
+	tv->index = (tv->index + 1) & TVN_MASK;
+}
+
+static void run_timers(void)
+{
+	struct timer_list * timer;
+	int n;
+
+	while ((long) (jiffies - timer_jiffies) >= 0) {
+		if (!tv1.index) {
+			n = 1;
+			do {
+				cascade_timers(tvecs[n]);
+			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
 		}
+		// 运行当前tick到期的定时器, 定时器函数可能再加定时器
+		while ((timer = tv1.vec[tv1.index])) {
+			detach_timer(timer);
+			timers_run++;
+			timer->function(timer->data);
+		}
+		timer_jiffies++;
+		tv1.index = (tv1.index + 1) & TVR_MASK;
 	}
-	sti();
+}
+
+static void show_timer_stat(void)
+{
+	printk("%d timers added, %d run, %d cascaded\n\r",
+		timers_added,timers_run,timers_cascaded);
 }
 
 void do_timer(long cpl)
@@ -321,17 +653,7 @@ void do_timer(long cpl)
 	else
 		current->stime++;
 
-	if (next_timer) {
-		next_timer->jiffies--;
-		while (next_timer && next_timer->jiffies <= 0) {
-			void (*fn)(void);
-
-			fn = next_timer->fn;
-			next_timer->fn = NULL;
-			next_timer = next_timer->next;
-			(fn)();
-		}
-	}
+	run_timers();
 	if (current_DOR & 0xf0)
 		do_floppy_timer();
 	if ((--current->counter)>0) return; // 进程时间片减一, 如果时间片还没有用完, 那么就直接返回, 返回重新调度
@@ -346,7 +668,7 @@ int sys_alarm(long seconds)
 
 	if (old)
 		old = (old - jiffies) / HZ;
-	current->alarm = (seconds>0)?(jiffies+HZ*seconds):0;
+	set_alarm((seconds>0)?(jiffies+HZ*seconds):0);
 	return (old);
 }
 
@@ -394,20 +716,22 @@ void sched_init(void)
 
 	if (sizeof(struct sigaction) != 16)
 		panic("Struct sigaction MUST be 16 bytes");
-	set_tss_desc(gdt+FIRST_TSS_ENTRY,&(init_task.task.tss)); // 设置idle进程在GDT的TSS描述符
+	init_task.task.run_level = -1;	/* the idle task is never queued */
+	cpu_tss.esp0 = init_task.task.tss.esp0;
+	cpu_tss.ss0 = 0x10;
+	cpu_tss.trace_bitmap = 0x80000000;	/* io bitmap past the limit: none */
+	set_tss_desc(gdt+TSS_ENTRY,&cpu_tss); // 设置GDT中唯一的TSS描述符
 	set_ldt_desc(gdt+FIRST_LDT_ENTRY,&(init_task.task.ldt)); // 设置idle进程在GDT的LDT描述符
-	p = gdt+2+FIRST_TSS_ENTRY;
+	p = gdt+1+FIRST_LDT_ENTRY;
 	for(i=1;i<NR_TASKS;i++) { /* clear all task struct except 0 task */
 		task[i] = NULL;
 		p->a=p->b=0;
 		p++;
-		p->a=p->b=0;
-		p++;
 	}
 /* Clear NT, so that we won't have troubles with that later on */
 	__asm__("pushfl ; andl $0xffffbfff,(%esp) ; popfl");
-	// 这里只加载一次, 以后由switch_to()函数切换进程时去TSS结构中获取
-	ltr(0);  // 加载任务0的TSS
+	// TSS只加载这一次, 以后switch_to()只修改其中的esp0
+	ltr();   // 加载TSS
 	lldt(0); // 加载任务0的LDT
 	outb_p(0x36,0x43);		/* binary, mode 3, LSB/MSB, ch 0 */
 	outb_p(LATCH & 0xff , 0x40);	/* LSB */
@@ -58,13 +58,13 @@ sa_mask = 4
 sa_flags = 8
 sa_restorer = 12
 
-nr_system_calls = 72
+nr_system_calls = 74
 
 /*
  * Ok, I get parallel printer interrupts while using the floppy for some
  * strange reason. Urgel. Now I just ignore them.
  */
-.globl system_call,sys_fork,timer_interrupt,sys_execve
+.globl system_call,sys_fork,sys_vfork,ret_from_fork,timer_interrupt,sys_execve
 .globl hd_interrupt,floppy_interrupt,parallel_interrupt
 .globl device_not_available, coprocessor_error
 
@@ -218,8 +218,41 @@ sys_fork:
 	pushl %edi
 	pushl %ebp
 	pushl %eax
+	pushl $0
 	call copy_process   # 调用copy_process(), 在fork.c中
-	addl $20,%esp
+	addl $24,%esp
+1:	ret
+
+/*
+ * A new task starts here (switch_to() jumps to it), on the kernel stack
+ * copy_process() made: ebp, edi, esi and gs, then the stack of the
+ * parent's system call as in 'ret_from_system_call', with eax = 0.
+ * Interrupts are still off from schedule(), whose restore_flags() a new
+ * task never gets to.
+ */
+.align 2
+ret_from_fork:
+	popl %ebp
+	popl %edi
+	popl %esi
+	pop %gs
+	sti
+	jmp ret_from_sys_call
+
+# vfork: 和fork一样, 只是子进程借用父进程的地址空间
+.align 2
+sys_vfork:
+	call find_empty_process
+	testl %eax,%eax
+	js 1f
+	push %gs
+	pushl %esi
+	pushl %edi
+	pushl %ebp
+	pushl %eax
+	pushl $1
+	call copy_process
+	addl $24,%esp
 1:	ret
 
 hd_interrupt:
@@ -30,58 +30,154 @@
 
 volatile void do_exit(long code);
 
-static inline volatile void oom(void)
+volatile void oom(void)
 {
 	printk("out of memory\n\r");
 	do_exit(SIGSEGV);
 }
 
-#define invalidate() \
-__asm__("movl %%eax,%%cr3"::"a" (0))
-
 /* these are not to be changed without changing head.s etc */
-#define LOW_MEM 0x100000
-#define PAGING_MEMORY (15*1024*1024)   /* 15MB */
-#define PAGING_PAGES (PAGING_MEMORY>>12)
-#define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
+#define MAX_MEMORY TASK_BASE	/* see mem_init() */
+#define MAX_PAGING_PAGES ((MAX_MEMORY-LOW_MEM)>>12)
 #define USED 100
 
 #define CODE_SPACE(addr) ((((addr)+4095)&~4095) < \
 current->start_code + current->end_code)
 
-static long HIGH_MEMORY = 0;
+long HIGH_MEMORY = 0;
+
+unsigned long tlb_flushes = 0, tlb_page_flushes = 0;
+
+/*
+ * Flush the tlb entry of one linear address. The 386 can only reload
+ * cr3, which throws away everything - kernel mappings included - so we
+ * only do that on a 386 (x86 is set up by head.s).
+ */
+void invalidate_page(unsigned long address)
+{
+	if (x86 < 4) {
+		invalidate();
+		return;
+	}
+	tlb_page_flushes++;
+	__asm__ __volatile__("invlpg %0"::"m" (*(char *) address));
+}
+
+static unsigned long map_page(unsigned long page,unsigned long address,
+	int prot);
 
 #define copy_page(from,to) \
 __asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024))
 
-static unsigned char mem_map [ PAGING_PAGES ] = {0,};
+unsigned char * mem_map = NULL;	/* allocated by mem_init() */
+static int paging_pages = 0;
+
+static int shrink_page_cache(void);
+
+/*
+ * Free pages are kept in a bitmap, one bit per page of mem_map (set -
+ * free), with a count of them in nr_free_pages. free_hint is the
+ * lowest word of the bitmap that may have a bit set. mem_map still
+ * holds the reference counts: a page is free exactly when its count
+ * is 0.
+ */
+#define NR_FREE_WORDS ((MAX_PAGING_PAGES+31)/32)
+
+static unsigned long free_map[NR_FREE_WORDS] = {0,};
+static int free_hint = NR_FREE_WORDS;
+int nr_free_pages = 0;
+
+#define zero_page(page) \
+__asm__("cld ; rep ; stosl"::"a" (0),"D" (page),"c" (1024))
+
+static inline void mark_free(int nr)
+{
+	free_map[nr>>5] |= 1 << (nr & 31);
+	if ((nr>>5) < free_hint)
+		free_hint = nr>>5;
+	nr_free_pages++;
+}
+
+/*
+ * The idle task keeps a few cleared pages ready in zero_pool, so that
+ * get_free_page() doesn't have to clear them in the fault path. The
+ * pool is only filled while more than ZERO_RESERVE pages are free, and
+ * it is the first thing to go when they run out.
+ */
+#define NR_ZERO_PAGES 32
+#define ZERO_RESERVE 64
+
+static unsigned long zero_pool[NR_ZERO_PAGES];
+static int nr_zero_pages = 0;
+static unsigned long zero_hits = 0, zero_misses = 0;
+
+/*
+ * Get physical address of a free page, and mark it used. If no free
+ * pages left, return 0. The page is not cleared: use this only if
+ * the caller overwrites all of it.
+ *
+ * NOTE! This may sleep in swap_out() when memory is short (except in
+ * task 0), and so may get_free_page(). Anything the caller looked at
+ * before - page tables in particular - has to be checked again after.
+ */
+unsigned long __get_free_page(void)
+{
+	int i,bit;
+
+	// 没有空闲页: 先用清零池, 再回收页面缓存, 最后换出用户页面
+	while (!nr_free_pages) {
+		if (nr_zero_pages)
+			return zero_pool[--nr_zero_pages];
+		if (shrink_page_cache())
+			continue;
+		if (current == task[0] || !swap_out()) // 任务0不能睡眠
+			return 0;
+	}
+	for (i=free_hint ; i<NR_FREE_WORDS ; i++)
+		if (free_map[i])
+			break;
+	if (i >= NR_FREE_WORDS)
+		panic("free page bitmap disagrees with nr_free_pages");
+	free_hint = i;
+	__asm__("bsfl %1,%0":"=r" (bit):"r" (free_map[i]));
+	free_map[i] &= ~(1 << bit);
+	nr_free_pages--;
+	i = (i<<5) + bit;
+	mem_map[i] = 1;
+	return LOW_MEM + (i<<12);  // 返回空闲页的物理地址
+}
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * get_free_page() is __get_free_page() with the page cleared.
  */
 unsigned long get_free_page(void)
 {
-register unsigned long __res asm("ax");
-
-// ecx: 计数用, 开始设置为PAGING_PAGES
-// di: 用于mem_map内存开始地址
-__asm__("std ; repne ; scasb\n\t" // 置方向位, al(0)与对应每个页面的(di)内容比较
-	"jne 1f\n\t"                  // 如果没有等于0的字节, 则跳转到结束(返回0)
-	"movb $1,1(%%edi)\n\t"        // 将对应的页面位置设置为1
-	"sall $12,%%ecx\n\t"          // 页面数 * 4k == 相对页面开始地址
-	"addl %2,%%ecx\n\t"           // 加上低端内存地址(0x100000)
-	"movl %%ecx,%%edx\n\t"
-	"movl $1024,%%ecx\n\t"
-	"leal 4092(%%edx),%%edi\n\t"
-	"rep ; stosl\n\t"             // 清空内存页数据
-	"movl %%edx,%%eax\n"
-	"1:"
-	:"=a" (__res)
-	:"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-	"D" (mem_map+PAGING_PAGES-1)
-	);
-return __res;  // 返回空闲页的物理地址
+	unsigned long page;
+
+	if (nr_zero_pages) {
+		zero_hits++;
+		return zero_pool[--nr_zero_pages];
+	}
+	zero_misses++;
+	if ((page = __get_free_page()))
+		zero_page(page);
+	return page;
+}
+
+/*
+ * Called by the idle task: clear one more page for the pool. One at
+ * a time, so that a task that wakes up doesn't wait long for the cpu.
+ */
+void fill_zero_pool(void)
+{
+	unsigned long page;
+
+	if (nr_zero_pages >= NR_ZERO_PAGES || nr_free_pages <= ZERO_RESERVE)
+		return;
+	if (!(page = __get_free_page()))
+		return;
+	zero_page(page);
+	zero_pool[nr_zero_pages++] = page;
 }
 
 /*
@@ -95,43 +191,110 @@ void free_page(unsigned long addr)
 		panic("trying to free nonexistent page");
 	addr -= LOW_MEM;
 	addr >>= 12;
-	if (mem_map[addr]--) return;
-	mem_map[addr]=0;
-	panic("trying to free free page");
+	if (!mem_map[addr])
+		panic("trying to free free page");
+	if (!--mem_map[addr])
+		mark_free(addr);
+}
+
+/*
+ * Drop a reference to a page table. A shared table (see unshare_table())
+ * only loses a count, the last user frees the pages and swap entries in
+ * it as well.
+ */
+static void release_table(unsigned long table)
+{
+	unsigned long * pg_table = (unsigned long *) table;
+	int nr;
+
+	if (mem_map[MAP_NR(table)] == 1)
+		for (nr=0 ; nr<1024 ; nr++,pg_table++) {
+			if (1 & *pg_table)
+				free_page(0xfffff000 & *pg_table);
+			else if (*pg_table) // 页面在交换设备上
+				swap_free(*pg_table >> 1);
+			*pg_table = 0;
+		}
+	free_page(table);
 }
 
 /*
  * This function frees a continuos block of page tables, as needed
  * by 'exit()'. As does copy_page_tables(), this handles only 4Mb blocks.
+ * 'pgd' is the page directory they are in (tss.cr3 of the task).
  */
-int free_page_tables(unsigned long from,unsigned long size)
+int free_page_tables(unsigned long pgd,unsigned long from,unsigned long size)
 {
-	unsigned long *pg_table;
-	unsigned long * dir, nr;
+	unsigned long * dir;
 
 	if (from & 0x3fffff)
 		panic("free_page_tables called with wrong alignment");
-	if (!from)
+	if (!from || !pgd)
 		panic("Trying to free up swapper memory space");
 	size = (size + 0x3fffff) >> 22;  // 除以4m, 计算出页目录项数
-	dir = (unsigned long *) ((from>>20) & 0xffc); /* _pg_dir = 0 */
+	dir = PDE(pgd,from);
 	for ( ; size-- > 0 ; dir++) {
 		if (!(1 & *dir)) // 如果内存页无效, 跳过此页
 			continue;
-		pg_table = (unsigned long *) (0xfffff000 & *dir);
-		for (nr=0 ; nr<1024 ; nr++) {
-			if (1 & *pg_table)
-				free_page(0xfffff000 & *pg_table);
-			*pg_table = 0;
-			pg_table++;
-		}
-		free_page(0xfffff000 & *dir);
+		release_table(0xfffff000 & *dir);
 		*dir = 0;
 	}
 	invalidate(); // 刷新CPU的高速缓存
 	return 0;
 }
 
+/*
+ * Page tables of a forked process are shared with its parent, with the
+ * page directory entry write-protected and the table's mem_map count
+ * raised, just as copy-on-write does for the pages themselves. The first
+ * write through such an entry - a write-protect fault, or the kernel
+ * about to change a pte - calls unshare_table(). If nobody else uses the
+ * table any more the entry is simply made writable again, otherwise the
+ * table is copied, write-protecting the pages in both copies.
+ */
+static void unshare_table(unsigned long * dir)
+{
+	unsigned long old_table,new_table,this_page;
+	unsigned long *from,*to;
+	int nr;
+
+	if ((*dir & 3) != 1)
+		return;
+	old_table = 0xfffff000 & *dir;
+	if (mem_map[MAP_NR(old_table)] == 1) {
+		*dir |= 2;
+		invalidate();
+		return;
+	}
+	/* we may sleep below: hold our own reference to the old table */
+	mem_map[MAP_NR(old_table)]++;
+	if (!(new_table = __get_free_page())) {
+		release_table(old_table);
+		oom();
+	}
+	from = (unsigned long *) old_table;
+	to = (unsigned long *) new_table;
+	for (nr = 0 ; nr < 1024 ; nr++,from++,to++) {
+		this_page = *from;
+		if (this_page && !(1 & this_page)) { // 换出的页面先换入
+			swap_in(from);
+			this_page = *from;
+		}
+		if (!(1 & this_page)) {
+			*to = 0;
+			continue;
+		}
+		this_page &= ~2;
+		*from = *to = this_page;
+		if (this_page > LOW_MEM)
+			mem_map[MAP_NR(this_page)]++;
+	}
+	*dir = new_table | 7;
+	invalidate();
+	release_table(old_table);	/* our extra reference */
+	release_table(old_table);	/* and the one *dir had */
+}
+
 /*
  *  Well, here is one of the most complicated functions in mm. It
  * copies a range of linerar addresses by copying only the pages.
@@ -148,8 +311,16 @@ int free_page_tables(unsigned long from,unsigned long size)
  * doesn't take any more memory - we don't copy-on-write in the low
  * 1 Mb-range, so the pages can be shared with the kernel. Thus the
  * special case for nr=xxxx.
+ *
+ * NOTE 3!!! Otherwise the page tables aren't copied at all: they are
+ * shared write-protected (see unshare_table() above), so a fork that
+ * is followed by exec() only ever copies the tables it writes to.
+ *
+ * The two ranges are in different page directories, from_pgd is the
+ * parent's and to_pgd the child's.
  */
-int copy_page_tables(unsigned long from,unsigned long to,long size)
+int copy_page_tables(unsigned long from_pgd,unsigned long to_pgd,
+	unsigned long from,unsigned long to,long size)
 {
 	unsigned long * from_page_table;
 	unsigned long * to_page_table;
@@ -160,9 +331,9 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 	if ((from & 0x3fffff) || (to & 0x3fffff)) // 如果不是64MB对齐, 那么就出错
 		panic("copy_page_tables called with wrong alignment");
 	// 源地址所在页目录项
-	from_dir = (unsigned long *) ((from >> 20) & 0xffc); /* _pg_dir = 0 */
+	from_dir = PDE(from_pgd,from);
 	// 目标地址所在页目录项
-	to_dir = (unsigned long *) ((to >> 20) & 0xffc);
+	to_dir = PDE(to_pgd,to);
 	// 要复制多少个项
 	size = ((unsigned) (size+0x3fffff)) >> 22;
 	for( ; size-- > 0 ; from_dir++,to_dir++) {
@@ -170,6 +341,13 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 			panic("copy_page_tables: already exist");
 		if (!(1 & *from_dir))
 			continue;
+		/* 共享整个页表, 页目录项设为只读 */
+		if (from) {
+			*from_dir &= ~2;
+			*to_dir = *from_dir;
+			mem_map[MAP_NR(0xfffff000 & *from_dir)]++;
+			continue;
+		}
 		// from_page_table为页表项
 		from_page_table = (unsigned long *) (0xfffff000 & *from_dir);
 		if (!(to_page_table = (unsigned long *) get_free_page()))
@@ -177,7 +355,7 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 		// 设置页目录表项的信息:
 		// 把最后3位设置为1, 表示对应页表映射的内存页面是: 用户级的,可读写的,存在的
 		*to_dir = ((unsigned long) to_page_table) | 7; // 7的二进制为: 111
-		nr = (from==0) ? 0xA0 : 1024;  // 0xA0 == 160
+		nr = 0xA0;  // 0xA0 == 160
 		for ( ; nr-- > 0 ; from_page_table++,to_page_table++) {
 			this_page = *from_page_table;
 			if (!(1 & this_page))
@@ -196,6 +374,23 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 	return 0;
 }
 
+/*
+ * A new task gets a page directory of its own: the kernel's entries
+ * are copied from pg_dir (the page tables themselves are shared, they
+ * never change after mem_init()), the user part is left empty.
+ */
+unsigned long new_page_dir(void)
+{
+	unsigned long dir;
+	int i;
+
+	if (!(dir = get_free_page()))
+		return 0;
+	for (i = 0 ; i < (TASK_BASE>>22) ; i++)
+		((unsigned long *) dir)[i] = pg_dir[i];
+	return dir;
+}
+
 /*
  * This function puts a page in memory at the wanted address.
  * It returns the physical address of the page gotten, 0 if
@@ -205,47 +400,83 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 // address映射到page
 unsigned long put_page(unsigned long page,unsigned long address)
 {
-	unsigned long tmp, *page_table;
-
-/* NOTE !!! This uses the fact that _pg_dir=0 */
-
 	if (page < LOW_MEM || page >= HIGH_MEMORY)
 		printk("Trying to put page %p at %p\n",page,address);
 	if (mem_map[(page-LOW_MEM)>>12] != 1) // 如果此内存页还没有申请, 提示错误
 		printk("mem_map disagrees with %p at %p\n",page,address);
+	return map_page(page,address,7);
+}
+
+/*
+ * Like put_page(), but the page is marked dirty: its contents were
+ * written by the kernel (exec arguments) and can't be read back from
+ * anywhere if the swapper throws a clean page away.
+ */
+unsigned long put_dirty_page(unsigned long page,unsigned long address)
+{
+	if (page < LOW_MEM || page >= HIGH_MEMORY)
+		printk("Trying to put page %p at %p\n",page,address);
+	if (mem_map[(page-LOW_MEM)>>12] != 1)
+		printk("mem_map disagrees with %p at %p\n",page,address);
+	return map_page(page,address,PAGE_DIRTY | 7);
+}
+
+/*
+ * map_page() is put_page() without the checks, and with the page
+ * protection given by the caller: shared pages are mapped read-only.
+ */
+static unsigned long map_page(unsigned long page,unsigned long address,
+	int prot)
+{
+	unsigned long tmp, *page_table;
+
 	// 找到address对应的页目录项
-	page_table = (unsigned long *) ((address>>20) & 0xffc);
-	if ((*page_table)&1) // 如果页表存在
+	page_table = PDE(current->tss.cr3,address);
+	if ((*page_table)&1) { // 如果页表存在
+		unshare_table(page_table);
 		page_table = (unsigned long *) (0xfffff000 & *page_table);
+	}
 	else { // 如果页表不存在, 则申请一块内存页保存
 		if (!(tmp=get_free_page()))
 			return 0;
-		*page_table = tmp|7;
-		page_table = (unsigned long *) tmp;
+		// get_free_page()可能睡眠, 期间页表可能已经有了
+		if ((*page_table)&1) {
+			free_page(tmp);
+			unshare_table(page_table);
+			page_table = (unsigned long *) (0xfffff000 & *page_table);
+		} else {
+			*page_table = tmp|7;
+			page_table = (unsigned long *) tmp;
+		}
 	}
 	// 映射到物理内存页page
-	page_table[(address>>12) & 0x3ff] = page | 7;
+	page_table[(address>>12) & 0x3ff] = page | prot;
 /* no need for invalidate */
 	return page;
 }
 
-void un_wp_page(unsigned long * table_entry)
+void un_wp_page(unsigned long * table_entry, unsigned long address)
 {
-	unsigned long old_page,new_page;
+	unsigned long old_entry,old_page,new_page;
 
-	old_page = 0xfffff000 & *table_entry;
+	old_entry = *table_entry;
+	old_page = 0xfffff000 & old_entry;
 	if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)]==1) {
 		*table_entry |= 2;
-		invalidate();
+		invalidate_page(address);
 		return;
 	}
-	if (!(new_page=get_free_page()))
+	if (!(new_page=__get_free_page()))	// copy_page()会覆盖整个页面
 		oom();
-	if (old_page >= LOW_MEM)
-		mem_map[MAP_NR(old_page)]--;
-	*table_entry = new_page | 7;
-	invalidate();
+	// __get_free_page()可能换出页面而睡眠, 页表项变了就让进程重新缺页
+	if (*table_entry != old_entry) {
+		free_page(new_page);
+		return;
+	}
 	copy_page(old_page,new_page);
+	*table_entry = new_page | 7;
+	invalidate_page(address);
+	free_page(old_page);
 }
 
 /*
@@ -257,29 +488,37 @@ void un_wp_page(unsigned long * table_entry)
  */
 void do_wp_page(unsigned long error_code,unsigned long address)
 {
+	unsigned long * dir = PDE(current->tss.cr3,address);
+	unsigned long * table_entry;
+
 #if 0
 /* we cannot do this yet: the estdio library writes to code space */
 /* stupid, stupid. I really want the libc.a from GNU */
 	if (CODE_SPACE(address))
 		do_exit(SIGSEGV);
 #endif
-	un_wp_page((unsigned long *)
-		(((address>>10) & 0xffc) + (0xfffff000 &
-		*((unsigned long *) ((address>>20) &0xffc)))));
+	unshare_table(dir);
+	table_entry = (unsigned long *)
+		(((address>>10) & 0xffc) + (0xfffff000 & *dir));
+	/* 页表可能是因为共享才只读的 */
+	if (!(2 & *table_entry))
+		un_wp_page(table_entry,address);
 
 }
 
 void write_verify(unsigned long address)
 {
-	unsigned long page;
+	unsigned long page, * dir = PDE(current->tss.cr3,address);
 
 	/* 页表项是否可写? 不可写就直接返回 */
-	if (!( (page = *((unsigned long *) ((address>>20) & 0xffc)) )&1))
+	if (!((page = *dir) & 1))
 		return;
+	unshare_table(dir);
+	page = *dir;
 	page &= 0xfffff000;
 	page += ((address>>10) & 0xffc); // address对应的页表项
 	if ((3 & *(unsigned long *) page) == 1)  /* non-writeable, present (不可写, 存在) */
-		un_wp_page((unsigned long *) page); // 写时复制
+		un_wp_page((unsigned long *) page,address); // 写时复制
 	return;
 }
 
@@ -311,10 +550,8 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 	unsigned long to_page;
 	unsigned long phys_addr;
 
-	from_page = to_page = ((address>>20) & 0xffc);
-
-	from_page += ((p->start_code>>20) & 0xffc);
-	to_page += ((current->start_code>>20) & 0xffc);
+	from_page = (unsigned long) PDE(p->tss.cr3,p->start_code+address);
+	to_page = (unsigned long) PDE(current->tss.cr3,current->start_code+address);
 /* is there a page-directory at from? */
 	from = *(unsigned long *) from_page;
 	if (!(from & 1)) // 如果源页表不存在, 返回
@@ -322,6 +559,7 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 	from &= 0xfffff000;
 	from_page = from + ((address>>10) & 0xffc); // 页表项地址
 	phys_addr = *(unsigned long *) from_page;   // 页表项内容
+	from = phys_addr;
 /* is the page clean and present? */
 	if ((phys_addr & 0x41) != 0x01)
 		return 0;
@@ -329,6 +567,7 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 	// 判断物理地址是否正确
 	if (phys_addr >= HIGH_MEMORY || phys_addr < LOW_MEM)
 		return 0;
+	unshare_table((unsigned long *) to_page);
 	to = *(unsigned long *) to_page;
 	if (!(to & 1)) {
 		if ((to = get_free_page()))
@@ -336,6 +575,9 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 		else
 			oom();
 	}
+	// 上面可能睡眠: p的页面可能已经被换出或者写过了
+	if (*(unsigned long *) from_page != from)
+		return 0;
 	to &= 0xfffff000;
 	to_page = to + ((address>>10) & 0xffc);
 	if (1 & *(unsigned long *) to_page)
@@ -345,7 +587,7 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 	*(unsigned long *) from_page &= ~2;
 	// 复制源内存页地址
 	*(unsigned long *) to_page = *(unsigned long *) from_page;
-	invalidate(); // 清除高速缓存
+	invalidate_page(p->start_code + address); // 只有源页表项变成了只读
 	phys_addr -= LOW_MEM;
 	phys_addr >>= 12;
 	mem_map[phys_addr]++; // 计数器加一
@@ -383,70 +625,406 @@ static int share_page(unsigned long address)
 	return 0;
 }
 
+/*
+ * The page cache keeps the pages of executables around after the last
+ * process using them has gone, so that running the same program again
+ * needs neither disk i/o nor copying. A page is found by device, inode
+ * and page number in the image. The cache holds one reference to each
+ * of its pages in mem_map, and they are always mapped read-only: a
+ * write gets its own copy through do_wp_page(), like any shared page.
+ *
+ * Pages nobody else is using are given back when memory runs out, and
+ * all pages of a file are dropped as soon as it is written to. Every
+ * write() does that, so the pages of a file are on a chain of their own
+ * as well (ino_hash): a file without cached pages costs a short walk.
+ */
+#define NR_CACHE 256
+#define NR_CACHE_HASH 64
+#define cache_hashfn(dev,ino,nr) (((dev)^(ino)^(nr)) & (NR_CACHE_HASH-1))
+#define ino_hashfn(dev,ino) (((dev)^(ino)) & (NR_CACHE_HASH-1))
+
+static struct cache_page {
+	unsigned short dev;
+	unsigned short ino;
+	unsigned long nr;		/* page number in the image */
+	unsigned long page;		/* 0 - free entry */
+	struct cache_page * next;
+	struct cache_page * ino_next;	/* same dev and ino */
+} page_cache[NR_CACHE];
+
+static struct cache_page * cache_hash[NR_CACHE_HASH] = {NULL, };
+static struct cache_page * ino_hash[NR_CACHE_HASH] = {NULL, };
+static int cache_clock = 0;
+
+static void remove_cache_page(struct cache_page * p)
+{
+	struct cache_page ** pp;
+
+	pp = cache_hash + cache_hashfn(p->dev,p->ino,p->nr);
+	for ( ; *pp ; pp = &(*pp)->next)
+		if (*pp == p) {
+			*pp = p->next;
+			break;
+		}
+	pp = ino_hash + ino_hashfn(p->dev,p->ino);
+	for ( ; *pp ; pp = &(*pp)->ino_next)
+		if (*pp == p) {
+			*pp = p->ino_next;
+			break;
+		}
+	free_page(p->page);
+	p->page = 0;
+}
+
+static unsigned long find_cache_page(int dev, int ino, unsigned long nr)
+{
+	struct cache_page * p;
+
+	for (p = cache_hash[cache_hashfn(dev,ino,nr)] ; p ; p = p->next)
+		if (p->dev == dev && p->ino == ino && p->nr == nr)
+			return p->page;
+	return 0;
+}
+
+/*
+ * Returns 1 if the page was put in the cache. If the cache is full,
+ * a page that only the cache uses is thrown out, oldest slot first.
+ */
+static int add_cache_page(int dev, int ino, unsigned long nr,
+	unsigned long page)
+{
+	struct cache_page * p;
+	int i;
+
+	for (i=0 ; i<NR_CACHE ; i++) {
+		p = page_cache + cache_clock;
+		cache_clock = (cache_clock+1) % NR_CACHE;
+		if (!p->page)
+			break;
+		if (mem_map[MAP_NR(p->page)] == 1) {
+			remove_cache_page(p);
+			break;
+		}
+	}
+	if (i >= NR_CACHE)
+		return 0;
+	p->dev = dev;
+	p->ino = ino;
+	p->nr = nr;
+	p->page = page;
+	p->next = cache_hash[cache_hashfn(dev,ino,nr)];
+	cache_hash[cache_hashfn(dev,ino,nr)] = p;
+	p->ino_next = ino_hash[ino_hashfn(dev,ino)];
+	ino_hash[ino_hashfn(dev,ino)] = p;
+	mem_map[MAP_NR(page)]++;
+	return 1;
+}
+
+/*
+ * Free the pages only the cache is using. Returns the number freed.
+ */
+static int shrink_page_cache(void)
+{
+	struct cache_page * p;
+	int freed = 0;
+
+	for (p = page_cache ; p < page_cache+NR_CACHE ; p++)
+		if (p->page && mem_map[MAP_NR(p->page)] == 1) {
+			remove_cache_page(p);
+			freed++;
+		}
+	return freed;
+}
+
+/*
+ * Drop the cached pages of an inode, or of the whole device if ino
+ * is 0. Processes that have them mapped keep their copies.
+ */
+void invalidate_pages(int dev, int ino)
+{
+	struct cache_page * p, ** pp;
+
+	if (!ino) {
+		for (p = page_cache ; p < page_cache+NR_CACHE ; p++)
+			if (p->page && p->dev == dev)
+				remove_cache_page(p);
+		return;
+	}
+	pp = ino_hash + ino_hashfn(dev,ino);
+	while ((p = *pp))
+		if (p->dev == dev && p->ino == ino)
+			remove_cache_page(p);	/* takes it off *pp */
+		else
+			pp = &p->ino_next;
+}
+
 // 缺页处理:
 // address是缺页的虚拟地址
+/*
+ * Faults above end_data are in the heap (below brk, growing up) or the
+ * stack (above brk, growing down), and both are usually touched a page
+ * after the other. do_anon_page() maps a cluster of cleared pages at a
+ * time, going in the direction the region grows. The cluster doubles,
+ * up to ANON_CLUSTER pages, each time a fault lands right after the
+ * last one, and drops back to a single page as soon as one doesn't, or
+ * when free memory is getting short.
+ */
+#define ANON_CLUSTER 16
+
+static unsigned long anon_faults = 0, anon_around = 0;
+
+static void do_anon_page(unsigned long address)
+{
+	unsigned long tmp,page,limit;
+	unsigned long * pte;
+	int step,n;
+
+	tmp = address - current->start_code;
+	if (tmp < current->brk) {
+		step = 4096;
+		limit = (current->brk + 4095) & 0xfffff000;
+	} else {
+		step = -4096;
+		limit = current->brk;
+	}
+	n = 1;
+	if (address == current->anon_next)
+		n = current->anon_cluster << 1;
+	if (n < 1 || nr_free_pages < ZERO_RESERVE)
+		n = 1;
+	if (n > ANON_CLUSTER)
+		n = ANON_CLUSTER;
+	current->anon_cluster = n;
+	anon_faults++;
+	get_empty_page(address);
+	current->anon_next = address + step;
+	while (--n > 0) {
+		address += step;
+		tmp += step;
+		if (step > 0 ? tmp >= limit : (tmp < limit || tmp < 4096))
+			break;
+		pte = PDE(current->tss.cr3,address);
+		if (*pte & 1) {
+			pte = (unsigned long *) (0xfffff000 & *pte);
+			if (pte[(address>>12) & 0x3ff]) // 已经映射了
+				break;
+		}
+		if (!(page = get_free_page()))
+			break;
+		if (!put_page(page,address)) {
+			free_page(page);
+			break;
+		}
+		anon_around++;
+		current->anon_next = address + step;
+	}
+}
+
+/*
+ * A fault in the executable usually means more faults right after it.
+ * text_around() maps the next few pages as well when that needs no
+ * I/O: from the page cache, or put together from blocks that are in
+ * the buffer cache already. Blocks of the pages it can't map are read
+ * ahead (without waiting), so they are there for the next fault and the
+ * requests can be merged into a few big ones.
+ */
+#define TEXT_AROUND 8
+
+static unsigned long text_faults = 0, text_around_hits = 0, text_reada = 0;
+
+static void text_around(struct m_inode * inode,unsigned long address)
+{
+	int nr[4], ahead[NR_READA];
+	unsigned long tmp,page,entry;
+	int i,j,block,n = 0;
+
+	for (i=1 ; i<TEXT_AROUND+NR_READA/4 ; i++) {
+		address += 4096;
+		tmp = address - current->start_code;
+		if (tmp + 4096 > current->end_data)
+			break;
+		entry = *PDE(current->tss.cr3,address);
+		if ((entry & 1) && *(unsigned long *) ((0xfffff000 & entry) +
+		    ((address>>10) & 0xffc)))
+			continue;	// 已经映射或者换出了
+		if (i < TEXT_AROUND &&
+		    (page = find_cache_page(inode->i_dev,inode->i_num,tmp>>12))) {
+			mem_map[MAP_NR(page)]++;
+			if (!map_page(page,address,5)) {
+				free_page(page);
+				break;
+			}
+			text_around_hits++;
+			continue;
+		}
+		block = 1 + tmp/BLOCK_SIZE;
+		for (j=0 ; j<4 ; block++,j++)
+			nr[j] = bmap(inode,block);
+		if (i < TEXT_AROUND && nr_free_pages > ZERO_RESERVE &&
+		    page_uptodate(inode->i_dev,nr)) {
+			if (!(page = __get_free_page()))
+				break;
+			j = (!bread_page(page,inode->i_dev,nr) &&
+				add_cache_page(inode->i_dev,inode->i_num,
+				tmp>>12,page)) ? 5 : 7;
+			if (!map_page(page,address,j)) {
+				free_page(page);
+				break;
+			}
+			text_around_hits++;
+			continue;
+		}
+		for (j=0 ; j<4 && n<NR_READA ; j++)
+			if (nr[j])
+				ahead[n++] = nr[j];
+		if (n >= NR_READA)
+			break;
+	}
+	if (n) {
+		text_reada += n;
+		bread_ahead(inode->i_dev,ahead,n);
+	}
+}
+
 void do_no_page(unsigned long error_code,unsigned long address)
 {
 	int nr[4];
 	unsigned long tmp;
 	unsigned long page;
+	struct m_inode * inode;
 	int block,i;
 
 	address &= 0xfffff000; // 过滤偏移地址
+	// 页表项不为0但不存在: 页面在交换设备上
+	page = *PDE(current->tss.cr3,address);
+	if (page & 1) {
+		page &= 0xfffff000;
+		page += (address >> 10) & 0xffc;
+		if (*(unsigned long *) page) {
+			swap_in((unsigned long *) page);
+			return;
+		}
+	}
 	tmp = address - current->start_code; // 缺页页面对应的逻辑地址
-	if (!current->executable || tmp >= current->end_data) {
-		get_empty_page(address);
+	if (!(inode = current->executable) || tmp >= current->end_data) {
+		do_anon_page(address);
 		return;
 	}
+	text_faults++;
+	// 先在页面缓存中查找
+	if ((page = find_cache_page(inode->i_dev,inode->i_num,tmp>>12))) {
+		mem_map[MAP_NR(page)]++;
+		if (map_page(page,address,5)) { // 只读映射
+			text_around(inode,address);
+			return;
+		}
+		free_page(page);
+		oom();
+	}
 	// 尝试共享内存页
 	if (share_page(tmp))
 		return;
-	// 如果共享失败, 则申请块新的内存页
-	if (!(page = get_free_page()))
+	// 如果共享失败, 则申请块新的内存页 (bread_page()会填满整个页面)
+	if (!(page = __get_free_page()))
 		oom();
 /* remember that 1 block is used for header */
 	block = 1 + tmp/BLOCK_SIZE; // 跳过文件头
 	for (i=0 ; i<4 ; block++,i++)
-		nr[i] = bmap(current->executable,block); // 获得逻辑块号
+		nr[i] = bmap(inode,block); // 获得逻辑块号
 	// 从设备读取数据到内存页(4k)
-	bread_page(page,current->executable->i_dev,nr);
+	block = bread_page(page,inode->i_dev,nr);
 	i = tmp + 4096 - current->end_data;
 	tmp = page + 4096; // 指向内存页尾端
 	while (i-- > 0) {
 		tmp--;
 		*(char *)tmp = 0;
 	}
-	if (put_page(page,address)) // 映射线性地址到物理地址
+	// 读取成功的页面才放入缓存
+	i = (!block && add_cache_page(inode->i_dev,inode->i_num,
+		(address - current->start_code)>>12,page)) ? 5 : 7;
+	if (map_page(page,address,i)) { // 映射线性地址到物理地址
+		text_around(inode,address);
 		return;
+	}
 	free_page(page);
 	oom();
 }
 
+/*
+ * head.s maps the low 16Mb. Memory above that gets its page tables
+ * here, taken from the start of main memory (main() keeps that below
+ * 16Mb, which is mapped already - checked below), and so does mem_map,
+ * which is sized from the amount of memory found. The kernel maps physical memory 1:1 in the
+ * first 64Mb of linear space, below TASK_BASE in every page directory
+ * (new_page_dir() copies these entries), so that is as much as we can
+ * handle - and as much as the BIOS will tell us about anyway.
+ */
 void mem_init(long start_mem, long end_mem)
 {
 	int i;
+	unsigned long addr, * pg_table;
 
 	HIGH_MEMORY = end_mem;
-	for (i=0 ; i<PAGING_PAGES ; i++) // PAGING_PAGES等于15MB的page数
+	paging_pages = (end_mem - LOW_MEM) >> 12;
+	start_mem = (start_mem + 4095) & ~4095;
+	/* page tables and mem_map must be in the 16Mb head.s has mapped */
+	addr = start_mem + ((paging_pages + 4095) & ~4095);
+	if (end_mem > 16*1024*1024 && !(x86_capability & X86_FEATURE_PSE))
+		addr += ((end_mem - 16*1024*1024 + 0x3fffff) >> 22) << 12;
+	if (addr > 16*1024*1024)
+		panic("mem_init: page tables and mem_map don't fit below 16Mb");
+	for (addr = 16*1024*1024 ; addr < end_mem ; addr += 4*1024*1024) {
+		if (x86_capability & X86_FEATURE_PSE) { // 4M大页, 不用页表
+			pg_dir[addr>>22] = addr | 0x87;
+			continue;
+		}
+		pg_table = (unsigned long *) start_mem;
+		start_mem += 4096;
+		for (i=0 ; i<1024 ; i++)
+			pg_table[i] = (addr + (i<<12)) | 7;
+		pg_dir[addr>>22] = ((unsigned long) pg_table) | 7;
+	}
+	invalidate();
+	mem_map = (unsigned char *) start_mem;
+	start_mem += (paging_pages + 4095) & ~4095;
+	for (i=0 ; i<paging_pages ; i++)
 		mem_map[i] = USED;
 	i = MAP_NR(start_mem);
 	end_mem -= start_mem;
 	end_mem >>= 12;
-	while (end_mem-->0)
-		mem_map[i++]=0;
+	while (end_mem-->0) {
+		mem_map[i]=0;
+		mark_free(i++);
+	}
+}
+
+void show_page_stat(void)
+{
+	printk("%d free pages, %d cleared (%d hits, %d misses)\n\r",
+		nr_free_pages,nr_zero_pages,zero_hits,zero_misses);
+	printk("%d anonymous faults, %d pages mapped around\n\r",
+		anon_faults,anon_around);
+	printk("%d text faults, %d pages mapped around, %d blocks read ahead\n\r",
+		text_faults,text_around_hits,text_reada);
+	printk("%d tlb flushes, %d single page flushes (invlpg)\n\r",
+		tlb_flushes,tlb_page_flushes);
 }
 
 void calc_mem(void)
 {
 	int i,j,k,free=0;
 	long * pg_tbl;
+	unsigned long * dir = (unsigned long *) current->tss.cr3;
 
-	for(i=0 ; i<PAGING_PAGES ; i++)
+	for(i=0 ; i<paging_pages ; i++)
 		if (!mem_map[i]) free++;
-	printk("%d pages free (of %d)\n\r",free,PAGING_PAGES);
-	for(i=2 ; i<1024 ; i++) {
-		if (1&pg_dir[i]) {
-			pg_tbl=(long *) (0xfffff000 & pg_dir[i]);
+	printk("%d pages free (of %d), %d cleared in pool\n\r",
+		free,paging_pages,nr_zero_pages);
+	if (free != nr_free_pages)
+		printk("nr_free_pages says %d!\n\r",nr_free_pages);
+	for(i=TASK_BASE>>22 ; i<1024 ; i++) {
+		if (1&dir[i]) {
+			pg_tbl=(long *) (0xfffff000 & dir[i]);
 			for(j=k=0 ; j<1024 ; j++)
 				if (pg_tbl[j]&1)
 					k++;
@@ -0,0 +1,301 @@
+/*
+ *  linux/mm/swap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * This file does the swapping to and from disk. When there are no free
+ * pages left, get_free_page() calls swap_out(), which walks the user
+ * page tables like a clock hand. Pages that have been used since the
+ * last time round (the cpu sets the accessed bit) get another chance.
+ * Clean pages are simply dropped - a fault reads them back from the
+ * executable, or gives a new zeroed page, which is what they were.
+ * Dirty ones are written to the swap device, and the page table entry
+ * holds the swap page number (shifted up, so the present bit stays 0).
+ * do_no_page() sees a non-zero entry and calls swap_in().
+ *
+ * The swap device (SWAP_DEV, from the boot sector) starts with a page
+ * holding a bitmap of the usable swap pages, with "SWAP-SPACE" in its
+ * last 10 bytes.
+ */
+
+#include <string.h>
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/head.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define SWAP_BITS (4096<<3)
+
+#define bitop(name,op) \
+static inline int name(char * addr,unsigned int nr) \
+{ \
+int __res; \
+__asm__ __volatile__("bt" op " %1,%2; adcl $0,%0" \
+:"=g" (__res) \
+:"r" (nr),"m" (*(addr)),"0" (0)); \
+return __res; \
+}
+
+bitop(bit,"")
+bitop(setbit,"s")
+bitop(clrbit,"r")
+
+/* the user part of a page directory, the kernel's part is never swapped */
+#define FIRST_VM_DIR (TASK_BASE>>22)
+#define LAST_VM_DIR ((TASK_BASE+TASK_SIZE)>>22)
+
+int SWAP_DEV = 0;
+
+static char * swap_bitmap = NULL;
+
+/*
+ * Only one process writes pages out at a time: swap_writing is the
+ * swap page being written, so that swap_in() of that very page waits
+ * for the write to finish instead of racing it in the request queue.
+ */
+static int swap_lock = 0;
+static int swap_writing = 0;
+static struct task_struct * swap_wait = NULL;
+
+static unsigned long swap_ins = 0, swap_outs = 0, swap_drops = 0;
+
+static int get_swap_page(void)
+{
+	int nr;
+
+	if (!swap_bitmap)
+		return 0;
+	for (nr = 1; nr < SWAP_BITS ; nr++)
+		if (clrbit(swap_bitmap,nr))
+			return nr;
+	return 0;
+}
+
+void swap_free(int swap_nr)
+{
+	if (!swap_nr)
+		return;
+	if (swap_bitmap && swap_nr < SWAP_BITS)
+		if (!setbit(swap_bitmap,swap_nr))
+			return;
+	printk("Swap-space bad (swap_free())\n\r");
+	return;
+}
+
+void swap_in(unsigned long *table_ptr)
+{
+	int swap_nr;
+	unsigned long page;
+
+	if (!swap_bitmap) {
+		printk("Trying to swap in without swap bit-map");
+		return;
+	}
+	if (1 & *table_ptr) {
+		printk("trying to swap in present page\n\r");
+		return;
+	}
+	swap_nr = *table_ptr >> 1;
+	if (!swap_nr) {
+		printk("No swap page in swap_in\n\r");
+		return;
+	}
+	if (!(page = __get_free_page()))
+		oom();
+	while (swap_lock && swap_writing == swap_nr)
+		sleep_on(&swap_wait);
+	// 写出失败的话页面已经放回去了
+	if (*table_ptr != swap_nr<<1) {
+		free_page(page);
+		return;
+	}
+	if (!read_swap_page(swap_nr, (char *) page)) {
+		// 读不回来: 页表项不动, 让进程收到SIGSEGV
+		printk("swap_in: read error on swap page %d\n\r",swap_nr);
+		free_page(page);
+		current->signal |= 1<<(SIGSEGV-1);
+		return;
+	}
+	// 睡眠的时候可能已经被别人换入了
+	if (*table_ptr != swap_nr<<1) {
+		free_page(page);
+		return;
+	}
+	if (setbit(swap_bitmap,swap_nr))
+		printk("swapping in multiply from same page\n\r");
+	*table_ptr = page | (PAGE_DIRTY | 7);
+	swap_ins++;
+}
+
+/*
+ * Only the current page directory can have the old entry in the tlb,
+ * the others get flushed when we switch to them (cr3 is reloaded).
+ */
+static inline void swap_invalidate(unsigned long dir, unsigned long address)
+{
+	if (dir == current->tss.cr3)
+		invalidate_page(address);
+}
+
+/*
+ * Returns 1 if the entry no longer maps a page, 0 if it was left alone.
+ */
+static int try_to_swap_out(unsigned long dir, unsigned long * table_ptr,
+	unsigned long address)
+{
+	unsigned long page, old;
+	int swap_nr;
+
+	page = old = *table_ptr;
+	if (!(PAGE_PRESENT & page))
+		return 0;
+	if (PAGE_ACCESSED & page) { // 最近访问过, 再给一次机会
+		*table_ptr &= ~PAGE_ACCESSED;
+		return 0;
+	}
+	page &= 0xfffff000;
+	if (page < LOW_MEM || page >= HIGH_MEMORY)
+		return 0;
+	if (PAGE_DIRTY & *table_ptr) {
+		if (mem_map[MAP_NR(page)] != 1)
+			return 0;
+		if (!(swap_nr = get_swap_page()))
+			return 0;
+		*table_ptr = swap_nr<<1;
+		swap_invalidate(dir,address);
+		swap_writing = swap_nr;
+		if (!write_swap_page(swap_nr, (char *) page)) {
+			swap_writing = 0;
+			printk("try_to_swap_out: write error on swap page %d\n\r",
+				swap_nr);
+			/* keep the page, unless the entry went away meanwhile */
+			if (*table_ptr == swap_nr<<1) {
+				*table_ptr = old;
+				swap_free(swap_nr);
+				return 0;
+			}
+			free_page(page);
+			return 1;
+		}
+		swap_writing = 0;
+		free_page(page);
+		swap_outs++;
+		return 1;
+	}
+	*table_ptr = 0;
+	swap_invalidate(dir,address);
+	free_page(page);
+	swap_drops++;
+	return 1;
+}
+
+/*
+ * Go round the user page tables of all tasks (at most twice: the first
+ * pass may only clear accessed bits) until a page is unmapped. Shared
+ * page tables are skipped, they belong to several processes, and so are
+ * vfork()ed children, which use their parent's page directory. Returns 1
+ * if something was unmapped - the caller checks if that actually freed
+ * a page.
+ */
+int swap_out(void)
+{
+	static int task_nr = 1;
+	static int dir_entry = FIRST_VM_DIR;
+	static int page_entry = -1;
+	int counter = 2 * NR_TASKS * (LAST_VM_DIR - FIRST_VM_DIR);
+	struct task_struct * p;
+	unsigned long dir, pg_table;
+	int done = 0;
+
+	if (swap_lock) {
+		sleep_on(&swap_wait);
+		return 1;
+	}
+	swap_lock = 1;
+	while (counter > 0) {
+		p = task[task_nr];
+		if (!p || !(dir = p->tss.cr3) || p->vfork) {
+			dir_entry = LAST_VM_DIR;	/* nothing here, next task */
+			goto next;
+		}
+		pg_table = ((unsigned long *) dir)[dir_entry];
+		if ((pg_table & 1) &&
+		    mem_map[MAP_NR(pg_table & 0xfffff000)] == 1) {
+			pg_table &= 0xfffff000;
+			while (++page_entry < 1024)
+				if (try_to_swap_out(dir, page_entry +
+				    (unsigned long *) pg_table,
+				    (dir_entry<<22) + (page_entry<<12))) {
+					done = 1;
+					break;
+				}
+			if (done)
+				break;
+		}
+		dir_entry++;
+next:
+		page_entry = -1;
+		counter--;
+		if (dir_entry >= LAST_VM_DIR) {
+			dir_entry = FIRST_VM_DIR;
+			if (++task_nr >= NR_TASKS)
+				task_nr = 1;
+		}
+	}
+	invalidate();	/* for the accessed bits */
+	swap_lock = 0;
+	wake_up(&swap_wait);
+	return done;
+}
+
+void init_swapping(void)
+{
+	int i,j;
+
+	if (!SWAP_DEV)
+		return;
+	if (!(swap_bitmap = (char *) get_free_page())) {
+		printk("Unable to start swapping: out of memory :-)\n\r");
+		return;
+	}
+	if (!read_swap_page(0,swap_bitmap) ||
+	    strncmp("SWAP-SPACE",swap_bitmap+4086,10)) {
+		printk("Unable to find swap-space signature\n\r");
+		free_page((long) swap_bitmap);
+		swap_bitmap = NULL;
+		return;
+	}
+	memset(swap_bitmap+4086,0,10);
+	if (bit(swap_bitmap,0)) {
+		printk("Bad swap-space bit-map\n\r");
+		free_page((long) swap_bitmap);
+		swap_bitmap = NULL;
+		return;
+	}
+	j = 0;
+	for (i = 1 ; i < SWAP_BITS ; i++)
+		if (bit(swap_bitmap,i))
+			j++;
+	if (!j) {
+		free_page((long) swap_bitmap);
+		swap_bitmap = NULL;
+		return;
+	}
+	printk("Swap device ok: %d pages (%d bytes) swap-space\n\r",j,j*4096);
+}
+
+void show_swap_stat(void)
+{
+	int i,j = 0;
+
+	if (swap_bitmap)
+		for (i = 1 ; i < SWAP_BITS ; i++)
+			if (bit(swap_bitmap,i))
+				j++;
+	printk("%d free swap pages, %d in, %d out, %d clean dropped\n\r",
+		j,swap_ins,swap_outs,swap_drops);
+}